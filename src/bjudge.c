@@ -0,0 +1,156 @@
+/* ex: set ts=4: */
+
+#include <stdio.h>
+#include <string.h>
+#ifdef DEBUG
+#include <assert.h>
+#endif
+#include "bjudge.h"
+#include "user.h"
+
+#if BSTAT_BATCH > 64
+#error "bjudge_mask_t needs a bit for every entry of a batch"
+#endif
+
+#define BJUDGE_GROUPS	16 /* groups compared a vector at a time, past that we hash */
+
+/*
+	a non-dir entry can be deleted by its owner or root no matter what, and
+	by anybody else if it isn't sticky, isn't in a sticky dir and they have
+	every perm wanted by way of its group bits (if in its group) or other
+	bits. that's report_calc() for a file at the end of a delete scan, minus
+	the mount point checks, entries on another dev get the full treatment.
+*/
+
+/* a batch pulled apart a field at a time, lanes past the last entry are zero */
+typedef struct {
+	int32_t mode[BSTAT_BATCH];
+	int32_t uid[BSTAT_BATCH];
+	int32_t gid[BSTAT_BATCH];
+	int32_t grp[BSTAT_BATCH]; /* -1 if user is in gid, only filled in if we hash */
+} bjudge_soa_t;
+
+static bjudge_mask_t bjudge_run(const bjudge_soa_t *, size_t, const user_t *, int32_t, int, int);
+
+#if defined(__GNUC__)
+
+#define BJUDGE_LANES	8
+
+/* 8 lanes of generic vector, the Makefile asks for no -O or -m flags so this */
+/* builds for the baseline target (two sse2 halves on x86-64); a CFLAGS with */
+/* -O2 -mavx2 gets the whole 8 in one register, nothing else has to change */
+typedef int32_t bjudge_vec_t __attribute__((vector_size(BJUDGE_LANES * sizeof(int32_t))));
+
+/* returns a bit for each entry the user could delete */
+static bjudge_mask_t bjudge_run(const bjudge_soa_t *b, size_t n, const user_t *user, int32_t want, int hashed, int sticky)
+{
+	bjudge_vec_t zero = { 0 }, vuid, vwant, vgid[BJUDGE_GROUPS];
+	bjudge_mask_t ok = 0;
+	size_t i, g, ngid = hashed ? 0 : user->ngroups;
+
+	vuid = zero + (int32_t)user->uid;
+	vwant = zero + want;
+	for (g = 0; g < ngid; g++)
+		vgid[g] = zero + (int32_t)user->groups[g];
+
+	for (i = 0; i < n; i += BJUDGE_LANES) {
+		bjudge_vec_t mode, uid, gid, grp, pass;
+		size_t j;
+		memcpy(&mode, &b->mode[i], sizeof mode);
+		memcpy(&uid, &b->uid[i], sizeof uid);
+		pass = (uid == vuid);
+		if (!sticky) {
+			if (hashed) {
+				memcpy(&grp, &b->grp[i], sizeof grp);
+			} else {
+				memcpy(&gid, &b->gid[i], sizeof gid);
+				for (grp = zero, g = 0; g < ngid; g++)
+					grp |= (gid == vgid[g]);
+			}
+			/* group bits shifted down line up with other's */
+			pass |= ((((mode | ((mode >> 3) & grp)) & vwant) == vwant) & ((mode & S_ISVTX) == zero));
+		}
+		for (j = 0; j < BJUDGE_LANES; j++)
+			if (pass[j])
+				ok |= (bjudge_mask_t)1 << (i + j);
+	}
+	return ok;
+}
+
+#else /* one at a time */
+
+#define BJUDGE_LANES	1
+
+static bjudge_mask_t bjudge_run(const bjudge_soa_t *b, size_t n, const user_t *user, int32_t want, int hashed, int sticky)
+{
+	bjudge_mask_t ok = 0;
+	size_t i, g;
+
+	for (i = 0; i < n; i++) {
+		int32_t grp = b->grp[i];
+		if ((int32_t)user->uid == b->uid[i]) {
+			ok |= (bjudge_mask_t)1 << i;
+			continue;
+		}
+		if (sticky || (b->mode[i] & S_ISVTX))
+			continue;
+		for (g = 0; !hashed && g < user->ngroups && 0 == grp; g++)
+			grp = ((int32_t)user->groups[g] == b->gid[i]) ? -1 : 0;
+		if (((b->mode[i] | ((b->mode[i] >> 3) & grp)) & want) == want)
+			ok |= (bjudge_mask_t)1 << i;
+	}
+	return ok;
+}
+
+#endif
+
+/* bst holds n entries of a dir on dev, which carries sticky mask reasmask */
+/* returns the entries that need a full look with report_calc() */
+bjudge_mask_t bjudge_batch(const bstat_t *bst, size_t n, const user_t *user, perm_t permeff, perm_t reasmask, dev_t dev)
+{
+	bjudge_soa_t b;
+	const bstat_ent_t *ent;
+	bjudge_mask_t look = 0; /* needs a look whatever its perms */
+	int32_t want = 0; /* other's bits for the perms wanted */
+	size_t i;
+	int hashed;
+
+#ifdef DEBUG
+	assert(NULL != bst);
+	assert(NULL != user);
+	assert(n <= BSTAT_BATCH);
+#endif
+
+	if (0 == n)
+		return 0;
+	if (!(permeff & PERM_DELE) || (permeff & PERM_CREA)) /* not a delete scan */
+		return BJUDGE_ALL(n);
+
+	if (permeff & PERM_READ)
+		want |= S_IROTH;
+	if (permeff & PERM_WRIT)
+		want |= S_IWOTH;
+	if (permeff & PERM_EXEC)
+		want |= S_IXOTH;
+	hashed = user->ngroups > BJUDGE_GROUPS;
+
+	for (i = 0, ent = bst->ents; i < n; i++, ent++) {
+		if (0 != ent->err || S_ISDIR(ent->st.st_mode) || ent->st.st_dev != dev) {
+			look |= (bjudge_mask_t)1 << i;
+			b.mode[i] = b.uid[i] = b.gid[i] = b.grp[i] = 0;
+			continue;
+		}
+		b.mode[i] = (int32_t)ent->st.st_mode;
+		b.uid[i] = (int32_t)ent->st.st_uid;
+		b.gid[i] = (int32_t)ent->st.st_gid;
+		b.grp[i] = (hashed && (ent->st.st_mode & S_IRWXG) && user_in_group(user, ent->st.st_gid)) ? -1 : 0;
+	}
+	for (; i % BJUDGE_LANES; i++) /* pad out the last vector */
+		b.mode[i] = b.uid[i] = b.gid[i] = b.grp[i] = 0;
+
+	if (UID_ROOT == user->uid) /* root may delete any file */
+		return look;
+
+	return (look | ~bjudge_run(&b, n, user, want, hashed, reasmask & REAS_NO_STICKY)) & BJUDGE_ALL(n);
+}
+
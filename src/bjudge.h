@@ -0,0 +1,27 @@
+/* ex: set ts=4: */
+
+#ifndef BJUDGE_H
+#define BJUDGE_H
+
+#include <stdint.h>
+#include "shac.h"
+#include "bstat.h"
+
+/*
+	judges a whole bstat_read() batch for a delete scan at once. the fields
+	that decide it are pulled out a field at a time, mode[], uid[] and
+	gid[], and compared a vector at a time against the user's uid, groups
+	and the perms wanted. what comes back is a bit per entry that needs a
+	closer look: dirs, errors, mount points and any file that might not be
+	deletable. the rest are files the user could delete, and nobody needs
+	to hear about those, so they can be skipped outright.
+*/
+
+typedef uint64_t bjudge_mask_t; /* bit i is bstat_t ents[i] */
+
+#define BJUDGE_ALL(n)	((n) >= 64 ? ~(bjudge_mask_t)0 : ((bjudge_mask_t)1 << (n)) - 1)
+
+bjudge_mask_t bjudge_batch(const bstat_t *, size_t, const user_t *, perm_t, perm_t, dev_t);
+
+#endif
+
@@ -0,0 +1,512 @@
+/* ex: set ts=4: */
+
+#define _GNU_SOURCE /* struct statx */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h> /* fstatat, AT_* */
+#include <unistd.h>
+#include <time.h> /* clock_gettime */
+#ifdef DEBUG
+#include <assert.h>
+#endif
+#include "shac.h"
+#include "bstat.h"
+#include "util.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define BSTAT_URING
+#endif
+#endif
+
+#define BSTAT_RING_BATCHES	16 /* batches the ring gets once things are slow, then we look again */
+
+static void bstat_ent_init(bstat_ent_t *, char *, const char *, unsigned char);
+#ifdef DENTS_LNK_MODE
+static void bstat_ent_lnk(bstat_ent_t *, dev_t);
+#endif
+
+#ifdef BSTAT_URING
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h> /* makedev */
+#include <linux/io_uring.h>
+
+/* no liburing, the three syscalls and two mmaps are all we need */
+struct bstat_ring {
+	int fd;
+	void *sq_map, *cq_map;
+	size_t sq_size, cq_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned queued; /* sqes written that the kernel hasn't taken yet */
+	unsigned nfly; /* slots queued or in the kernel */
+	unsigned ndone; /* slots finished but not handed back yet */
+	int unsupported; /* the kernel takes the ring but not statx on it */
+	int abandoned; /* gave up with requests in flight, they may still land in stx */
+	unsigned nspare, spare[BSTAT_BATCH]; /* slots with nothing in them */
+	unsigned seq_next, seq_last; /* dir order of the next entry to hand back, and past the last taken */
+	unsigned order[BSTAT_BATCH]; /* slot of entry seq, at seq % BSTAT_BATCH */
+	char state[BSTAT_BATCH]; /* RING_* */
+	bstat_ent_t ents[BSTAT_BATCH]; /* what each slot is for, see ring_read() */
+	char names[BSTAT_BATCH][NAME_MAX + 1];
+	struct statx stx[BSTAT_BATCH];
+};
+
+#define RING_SPARE	0
+#define RING_FLY	1 /* queued or in the kernel */
+#define RING_DONE	2
+
+#define ring_head(ring)	((ring)->order[(ring)->seq_next % BSTAT_BATCH]) /* slot next in dir order */
+#define ring_ready(ring)	((ring)->seq_next != (ring)->seq_last && RING_DONE == (ring)->state[ring_head(ring)])
+#define ring_busy(ring)	(NULL != (ring) && ((ring)->nfly > 0 || (ring)->ndone > 0))
+
+static void ring_free(bstat_ring_t *);
+
+/* set up a ring with room for a whole batch, NULL if the kernel says no */
+static bstat_ring_t *ring_alloc(void)
+{
+	struct io_uring_params p;
+	bstat_ring_t *ring;
+	unsigned i;
+
+	memset(&p, 0, sizeof p);
+	ring = xmalloc(sizeof *ring);
+	ring->queued = ring->nfly = ring->ndone = 0;
+	ring->unsupported = ring->abandoned = 0;
+	for (i = 0; i < BSTAT_BATCH; i++) {
+		ring->state[i] = RING_SPARE;
+		ring->spare[i] = BSTAT_BATCH - 1 - i;
+	}
+	ring->nspare = BSTAT_BATCH;
+	ring->seq_next = ring->seq_last = 0;
+	ring->sq_map = ring->cq_map = ring->sqes = MAP_FAILED;
+	/* ENOSYS on old kernels, EPERM where it's been locked down */
+	if (-1 == (ring->fd = syscall(SYS_io_uring_setup, BSTAT_BATCH, &p))) {
+		xfree(ring);
+		return NULL;
+	}
+
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP && ring->cq_size > ring->sq_size)
+		ring->sq_size = ring->cq_size;
+	ring->sq_map = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == ring->sq_map) {
+		ring_free(ring);
+		return NULL;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_map = ring->sq_map;
+	} else {
+		ring->cq_map = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (MAP_FAILED == ring->cq_map) {
+			ring_free(ring);
+			return NULL;
+		}
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (MAP_FAILED == ring->sqes) {
+		ring_free(ring);
+		return NULL;
+	}
+
+	ring->sq_tail = (unsigned *)((char *)ring->sq_map + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq_map + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_map + p.sq_off.array);
+	ring->cq_head = (unsigned *)((char *)ring->cq_map + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_map + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq_map + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_map + p.cq_off.cqes);
+
+	return ring;
+}
+
+static void ring_free(bstat_ring_t *ring)
+{
+	if (NULL == ring)
+		return;
+	if (MAP_FAILED != ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (MAP_FAILED != ring->cq_map && ring->cq_map != ring->sq_map)
+		munmap(ring->cq_map, ring->cq_size);
+	if (MAP_FAILED != ring->sq_map)
+		munmap(ring->sq_map, ring->sq_size);
+	close(ring->fd);
+	if (!ring->abandoned) /* otherwise the kernel may still write stx, leave it be */
+		xfree(ring);
+}
+
+/* queue an lstat() of name, relative to dirfd, for slot. ring_enter() sends it */
+static void ring_queue(bstat_ring_t *ring, int dirfd, const char *name, unsigned slot)
+{
+	unsigned tail = *ring->sq_tail; /* only we write it */
+	unsigned idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = dirfd;
+	sqe->addr = (uintptr_t)name;
+	sqe->len = STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_NLINK
+		| STATX_INO | STATX_SIZE | STATX_CTIME;
+	sqe->off = (uintptr_t)&ring->stx[slot];
+	sqe->statx_flags = AT_SYMLINK_NOFOLLOW; /* lstat(), not stat() */
+	sqe->user_data = slot;
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->state[slot] = RING_FLY;
+	ring->queued++;
+	ring->nfly++;
+}
+
+/* hand the kernel everything queued, then if wait is set sleep until */
+/* something finishes. returns -1 if the kernel won't, the ring is */
+/* abandoned then and whatever is in flight has to be done some other way */
+static int ring_enter(bstat_ring_t *ring, int wait)
+{
+	int r;
+	while (ring->queued > 0 || wait) {
+		r = syscall(SYS_io_uring_enter, ring->fd, ring->queued, wait ? 1 : 0,
+			wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (-1 == r && EINTR == errno)
+			continue;
+		/* a short submit goes round again, one that takes nothing would forever */
+		if (-1 == r || (0 == r && !wait)) {
+			ring->abandoned = 1;
+			return -1;
+		}
+		ring->queued -= (unsigned)r;
+		wait = 0;
+	}
+	return 0;
+}
+
+/* move everything the kernel has finished into ents, by slot */
+static void ring_reap(bstat_ring_t *ring, bstat_ent_t *ents)
+{
+	unsigned head = *ring->cq_head;
+
+	while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		unsigned slot = (unsigned)cqe->user_data;
+		bstat_ent_t *ent = &ents[slot];
+		struct statx *stx = &ring->stx[slot];
+		if (cqe->res < 0) {
+			ent->err = -cqe->res;
+			/* pre-5.6 kernels take the ring but not the opcode */
+			if (EINVAL == ent->err || EOPNOTSUPP == ent->err)
+				ring->unsupported = 1;
+		} else {
+			ent->err = 0;
+			ent->st.st_mode = stx->stx_mode;
+			ent->st.st_uid = stx->stx_uid;
+			ent->st.st_gid = stx->stx_gid;
+			ent->st.st_nlink = stx->stx_nlink;
+			ent->st.st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+			ent->st.st_ino = stx->stx_ino;
+			ent->st.st_size = stx->stx_size;
+			ent->st.st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+			ent->st.st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+		}
+		ring->state[slot] = RING_DONE;
+		ring->nfly--;
+		ring->ndone++;
+		head++;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* bstat_read() on the ring: keeps up to a batch of lstat()s of d's entries */
+/* in flight and hands back the ones that have finished, in dir order, so */
+/* the caller gets on with those while the rest are out. a slow one holds */
+/* back the ones after it, not the whole batch. anything still out comes */
+/* back from a later call, or is thrown away by bstat_done() */
+static size_t ring_read(bstat_t *b, dents_t *d, int nolnk, dev_t dev)
+{
+	bstat_ring_t *ring = b->ring;
+	const char *name;
+	unsigned char type;
+	unsigned slot;
+	size_t n = 0;
+	int wait;
+
+	/* top the ring up from the dir, unless it's on its way out */
+	if (b->ring_batches > 0 && !ring->unsupported && !ring->abandoned) {
+		b->ring_batches--;
+		while (ring->nspare > 0 && NULL != (name = dents_next(d, &type))) {
+			if (dents_is_dots(name))
+				continue; /* skip "special" entries */
+			slot = ring->spare[--ring->nspare];
+			ring->order[ring->seq_last++ % BSTAT_BATCH] = slot;
+			bstat_ent_init(&ring->ents[slot], ring->names[slot], name, type);
+#ifdef DENTS_LNK_MODE
+			if (nolnk && DT_LNK == type) { /* nothing to ask the kernel */
+				bstat_ent_lnk(&ring->ents[slot], dev);
+				ring->state[slot] = RING_DONE;
+				ring->ndone++;
+				continue;
+			}
+#endif
+			ring_queue(ring, d->fd, ring->names[slot], slot);
+		}
+	}
+
+	/* only sleep on the kernel if there's nothing to hand back without it */
+	for (wait = 0; ; wait = 1) {
+		if (-1 == ring_enter(ring, wait)) {
+			ring_reap(ring, ring->ents);
+			for (slot = 0; slot < BSTAT_BATCH; slot++) /* do the rest ourselves */
+				if (RING_FLY == ring->state[slot]) {
+					bstat_ent_t *ent = &ring->ents[slot];
+					ent->err = -1 == fstatat(d->fd, ent->name, &ent->st, AT_SYMLINK_NOFOLLOW) ? errno : 0;
+					ring->state[slot] = RING_DONE;
+					ring->ndone++;
+				}
+			ring->nfly = ring->queued = 0;
+			break;
+		}
+		ring_reap(ring, ring->ents);
+		if (ring_ready(ring) || 0 == ring->nfly)
+			break;
+	}
+
+	/* as far as the first one that isn't back yet */
+	for (; n < BSTAT_BATCH && ring_ready(ring); ring->seq_next++) {
+		bstat_ent_t *ent = &b->ents[n];
+		slot = ring_head(ring);
+		*ent = ring->ents[slot];
+		strcpy(b->names[n], ring->names[slot]);
+		ent->name = b->names[n];
+		if (ring->unsupported && (EINVAL == ent->err || EOPNOTSUPP == ent->err))
+			ent->err = -1 == fstatat(d->fd, ent->name, &ent->st, AT_SYMLINK_NOFOLLOW) ? errno : 0;
+		ring->state[slot] = RING_SPARE;
+		ring->spare[ring->nspare++] = slot;
+		ring->ndone--;
+		n++;
+	}
+
+	return n;
+}
+
+/* wait out and forget whatever ring_read() has in flight */
+static void ring_drain(bstat_ring_t *ring)
+{
+	unsigned slot;
+	while (ring->nfly > 0 && 0 == ring_enter(ring, 1))
+		ring_reap(ring, ring->ents);
+	for (slot = 0; slot < BSTAT_BATCH; slot++)
+		ring->state[slot] = RING_SPARE;
+	for (ring->nspare = 0; ring->nspare < BSTAT_BATCH; ring->nspare++)
+		ring->spare[ring->nspare] = ring->nspare;
+	ring->nfly = ring->ndone = ring->queued = 0;
+	ring->seq_next = ring->seq_last = 0;
+}
+
+/* lstat() paths[0..n) into ents[0..n), all at once */
+/* returns -1 if the ring can't do statx after all, or the kernel wouldn't */
+/* wait on it, entries are garbage then and the ring is done for */
+static int ring_paths(bstat_ring_t *ring, bstat_ent_t *ents, const char *const *paths, size_t n)
+{
+	unsigned i;
+	int wait;
+
+	/* slots are ours, bstat_read() hands back all it takes before the dir is closed */
+	for (i = 0; i < n; i++)
+		ring_queue(ring, AT_FDCWD, paths[i], i);
+	for (wait = 0; ring->nfly > 0; wait = 1) {
+		if (-1 == ring_enter(ring, wait))
+			return -1;
+		ring_reap(ring, ents);
+	}
+	for (i = 0; i < n; i++)
+		ring->state[i] = RING_SPARE;
+	ring->ndone = 0;
+
+	return ring->unsupported ? -1 : 0;
+}
+
+#else /* no io_uring */
+
+struct bstat_ring {
+	int unused;
+};
+
+#define ring_alloc()	NULL
+#define ring_free(ring)
+#define ring_busy(ring)	0
+#define ring_read(b, d, nolnk, dev)	0
+#define ring_drain(ring)
+#define ring_paths(ring, ents, paths, n)	(-1)
+
+#endif
+
+/* monotonic clock in nanoseconds, only differences mean anything */
+long long bstat_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* allocate a batch, the ring comes later if it's ever wanted */
+bstat_t *bstat_alloc(void)
+{
+	bstat_t *b = xmalloc(sizeof *b);
+	b->ring = NULL;
+	b->ring_batches = 0;
+	b->ring_none = 0;
+	return b;
+}
+
+/* b's ring, set up the first time it's wanted, NULL if the kernel is unwilling */
+static bstat_ring_t *bstat_ring(bstat_t *b)
+{
+	if (NULL == b->ring && !b->ring_none)
+		b->ring_none = (NULL == (b->ring = ring_alloc()));
+	return b->ring;
+}
+
+/* the ring turned out not to do statx, don't try it again */
+static void bstat_ring_off(bstat_t *b)
+{
+	ring_free(b->ring);
+	b->ring = NULL;
+	b->ring_none = 1;
+	b->ring_batches = 0;
+}
+
+/* fill in the parts of ent that don't need a stat, name is copied into buf */
+static void bstat_ent_init(bstat_ent_t *ent, char *buf, const char *name, unsigned char type)
+{
+	strncpy(buf, name, NAME_MAX);
+	buf[NAME_MAX] = '\0';
+	ent->name = buf;
+	ent->type = type;
+	ent->err = 0;
+	memset(&ent->st, 0, sizeof ent->st);
+}
+
+#ifdef DENTS_LNK_MODE
+/* a symlink on dev that isn't worth a stat */
+static void bstat_ent_lnk(bstat_ent_t *ent, dev_t dev)
+{
+	ent->st.st_mode = DENTS_LNK_MODE;
+	ent->st.st_uid = USER_NONE;
+	ent->st.st_gid = GROUP_NONE;
+	ent->st.st_nlink = 1;
+	ent->st.st_dev = dev; /* nothing gets mounted on a symlink */
+}
+#endif
+
+/* read the next batch of entries off d, skipping "." and "..", and lstat() them */
+/* relative to d's fd. returns how many of b->ents are filled in, 0 at the end */
+/* when nolnk is set symlinks aren't stat'ed, see DENTS_LNK_MODE, and get dev */
+/* a dir that isn't read to the end needs bstat_done() before it's closed */
+size_t bstat_read(bstat_t *b, dents_t *d, int nolnk, dev_t dev)
+{
+	const char *name;
+	unsigned char type;
+	size_t want[BSTAT_BATCH];
+	size_t n = 0, nwant = 0, i;
+	long long start;
+#ifdef DEBUG
+	assert(NULL != b);
+	assert(NULL != d);
+#endif
+
+	/* the ring, once it's wanted, and until it's handed back everything it took */
+	if ((b->ring_batches > 0 && NULL != bstat_ring(b)) || ring_busy(b->ring)) {
+		n = ring_read(b, d, nolnk, dev);
+		if (!ring_busy(b->ring) && (b->ring->unsupported || b->ring->abandoned))
+			bstat_ring_off(b); /* won't work any better next time */
+		return n;
+	}
+
+	while (n < BSTAT_BATCH && NULL != (name = dents_next(d, &type))) {
+		if (dents_is_dots(name))
+			continue; /* skip "special" entries */
+		bstat_ent_init(&b->ents[n], b->names[n], name, type);
+#ifdef DENTS_LNK_MODE
+		if (nolnk && DT_LNK == type) {
+			bstat_ent_lnk(&b->ents[n++], dev);
+			continue;
+		}
+#endif
+		want[nwant++] = n++;
+	}
+
+	if (0 == nwant)
+		return n;
+
+	/* statx on a ring always goes through a kernel worker, which loses to */
+	/* plain fstatat() when the inodes are cached. so the ring only gets */
+	/* the next few batches after one that had to wait on the disk or net */
+	start = bstat_nsec();
+	for (i = 0; i < nwant; i++) {
+		bstat_ent_t *ent = &b->ents[want[i]];
+		ent->err = -1 == fstatat(d->fd, ent->name, &ent->st, AT_SYMLINK_NOFOLLOW) ? errno : 0;
+	}
+	if (!b->ring_none && (bstat_nsec() - start) / nwant > BSTAT_SLOW_NSEC)
+		b->ring_batches = BSTAT_RING_BATCHES;
+
+	return n;
+}
+
+/* forget whatever bstat_read() still has in flight for the dir it was reading */
+void bstat_done(bstat_t *b)
+{
+	if (!ring_busy(b->ring))
+		return;
+	ring_drain(b->ring);
+	if (b->ring->unsupported || b->ring->abandoned)
+		bstat_ring_off(b);
+}
+
+/* lstat() every one of paths[0..n) at once, into b->ents in the same order */
+/* for a caller that's found doing them one at a time slow. n <= BSTAT_BATCH */
+/* returns -1 if there's no ring to do it with, ents are garbage then */
+int bstat_paths(bstat_t *b, const char *const *paths, size_t n)
+{
+	size_t i;
+#ifdef DEBUG
+	assert(NULL != b);
+	assert(NULL != paths);
+	assert(n <= BSTAT_BATCH);
+	assert(!ring_busy(b->ring));
+#endif
+
+	if (NULL == bstat_ring(b))
+		return -1;
+	for (i = 0; i < n; i++) {
+		bstat_ent_t *ent = &b->ents[i];
+		ent->name = paths[i]; /* the caller's, only while we're in here */
+		ent->type = DT_UNKNOWN;
+		ent->err = 0;
+		memset(&ent->st, 0, sizeof ent->st);
+	}
+	if (0 == ring_paths(b->ring, b->ents, paths, n))
+		return 0;
+	bstat_ring_off(b);
+	return -1;
+}
+
+void bstat_free(bstat_t *b)
+{
+	if (NULL == b)
+		return;
+	ring_free(b->ring);
+	xfree(b);
+}
+
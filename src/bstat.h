@@ -0,0 +1,55 @@
+/* ex: set ts=4: */
+
+#ifndef BSTAT_H
+#define BSTAT_H
+
+#include <limits.h> /* NAME_MAX */
+#include <sys/stat.h>
+#include "dents.h"
+
+/*
+	batched lstat() of directory entries. entries are read off a dents_t a
+	batch at a time and stat'ed relative to the dir fd. when that turns out
+	to be slow (cold cache, nfs) and the kernel lets us, the batches after
+	go out all at once as io_uring statx requests, so they cost one round
+	trip per batch instead of one per entry. the ring is kept topped up
+	and entries come back, still in dir order, as soon as the ones ahead
+	of them are done, so one slow inode holds up only what's behind it.
+	anywhere else it's plain
+	fstatat(), one after another. the ring isn't set up until the first
+	slow batch, most runs never need one.
+
+	the same ring can lstat() a list of whole paths at once, see
+	bstat_paths(), path_split() does that with what's left of a path
+	once it finds itself waiting on the walk down it.
+*/
+
+#define BSTAT_BATCH	64 /* entries in flight per dir */
+#define BSTAT_SLOW_NSEC	20000 /* per entry, about what a disk or network round trip costs at best */
+
+typedef struct {
+	const char *name; /* good until the next bstat_read() */
+	unsigned char type; /* DT_* from the dir, maybe DT_UNKNOWN */
+	int err; /* errno of a failed lstat(), st is garbage then */
+	struct stat st; /* mode, uid, gid, dev, ino, nlink, size and ctim only */
+} bstat_ent_t;
+
+typedef struct bstat_ring bstat_ring_t;
+
+typedef struct {
+	bstat_ent_t ents[BSTAT_BATCH];
+	char names[BSTAT_BATCH][NAME_MAX + 1]; /* copies, the dents buffer moves on */
+	bstat_ring_t *ring; /* NULL until we want one */
+	int ring_batches; /* how many more batches go to the ring */
+	int ring_none; /* the kernel wouldn't give us one, stuck with fstatat() */
+} bstat_t;
+
+bstat_t *bstat_alloc(void);
+size_t bstat_read(bstat_t *, dents_t *, int, dev_t);
+void bstat_done(bstat_t *);
+int bstat_paths(bstat_t *, const char *const *, size_t);
+long long bstat_nsec(void);
+void bstat_free(bstat_t *);
+
+#endif
+
@@ -0,0 +1,143 @@
+/* ex: set ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <limits.h> /* NAME_MAX */
+#ifdef DEBUG
+#include <assert.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h> /* SYS_getdents64, glibc only grew a wrapper in 2.30 */
+#endif
+#include "dents.h"
+#include "util.h"
+
+#ifdef __linux__
+
+#define DENTS_BUFMIN	(32 * 1024) /* what glibc's readdir() makes do with */
+#define DENTS_BUFMAX	(256 * 1024) /* plenty for a few thousand entries per call */
+/* the most a single record can take, so a read ending closer than this to the end filled us */
+#define DENTS_RECMAX	((sizeof(struct linux_dirent64) + NAME_MAX + 1 + 7) & ~7)
+
+/* what getdents64() fills the buffer with */
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/* start reading the open directory fd, which stays the caller's */
+dents_t *dents_open(int fd)
+{
+	dents_t *d;
+#ifdef DEBUG
+	assert(-1 != fd);
+#endif
+	d = xmalloc(sizeof *d);
+	d->fd = fd;
+	d->err = 0;
+	d->buf = xmalloc(DENTS_BUFMIN); /* most dirs are small, grown in dents_next() if not */
+	d->size = DENTS_BUFMIN;
+	d->len = d->pos = 0;
+	return d;
+}
+
+/* return the name of the next entry and store its DT_* in type */
+/* NULL once the dir is exhausted, or on error with d->err set */
+/* the name is only good until the next call */
+const char *dents_next(dents_t *d, unsigned char *type)
+{
+	struct linux_dirent64 *ent;
+#ifdef DEBUG
+	assert(NULL != d);
+	assert(NULL != type);
+#endif
+	if (d->pos >= d->len) {
+		/* the last read came back full, so this is a big dir, take more per call */
+		if (d->len > d->size - (long)DENTS_RECMAX && d->size < DENTS_BUFMAX) {
+			d->size *= 2;
+			xfree(d->buf);
+			d->buf = xmalloc(d->size);
+		}
+		d->len = syscall(SYS_getdents64, d->fd, d->buf, d->size);
+		d->pos = 0;
+		if (d->len <= 0) {
+			if (-1 == d->len)
+				d->err = errno;
+			d->len = 0;
+			return NULL;
+		}
+	}
+	ent = (struct linux_dirent64 *)(d->buf + d->pos);
+	d->pos += ent->d_reclen;
+	*type = ent->d_type;
+	return ent->d_name;
+}
+
+void dents_close(dents_t *d)
+{
+	if (NULL == d)
+		return;
+	xfree(d->buf);
+	xfree(d);
+}
+
+#else /* readdir() fallback */
+
+dents_t *dents_open(int fd)
+{
+	dents_t *d;
+	int dfd;
+#ifdef DEBUG
+	assert(-1 != fd);
+#endif
+	/* fdopendir() takes the fd it's given, so give it one of its own */
+	if (-1 == (dfd = dup(fd)))
+		return NULL;
+	d = xmalloc(sizeof *d);
+	d->fd = fd;
+	d->err = 0;
+	if (NULL == (d->dir = fdopendir(dfd))) {
+		close(dfd);
+		xfree(d);
+		return NULL;
+	}
+	return d;
+}
+
+const char *dents_next(dents_t *d, unsigned char *type)
+{
+	struct dirent *ent;
+#ifdef DEBUG
+	assert(NULL != d);
+	assert(NULL != type);
+#endif
+	errno = 0;
+	if (NULL == (ent = readdir(d->dir))) {
+		d->err = errno;
+		return NULL;
+	}
+#ifdef DT_UNKNOWN
+	*type = ent->d_type;
+#else
+	*type = 0;
+#endif
+	return ent->d_name;
+}
+
+void dents_close(dents_t *d)
+{
+	if (NULL == d)
+		return;
+	closedir(d->dir); /* closes the dup */
+	xfree(d);
+}
+
+#endif
+
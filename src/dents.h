@@ -0,0 +1,45 @@
+/* ex: set ts=4: */
+
+#ifndef DENTS_H
+#define DENTS_H
+
+#include <dirent.h> /* DT_* */
+#include <sys/stat.h>
+
+/*
+	bulk directory reader. on linux it pulls entries straight out of
+	getdents64() into a buffer that starts small and doubles each time a
+	read fills it, so a huge dir costs a handful of syscalls instead of one
+	per 32k of entries while a deep tree of small dirs stays cheap. it hands
+	back d_type so callers can tell what an entry is without a stat.
+	elsewhere it's a thin readdir() wrapper and d_type may just be
+	DT_UNKNOWN.
+*/
+
+typedef struct {
+	int fd; /* borrowed, never closed by us */
+	int err; /* errno of a failed read, 0 if we simply ran out */
+#ifdef __linux__
+	char *buf;
+	long size; /* of buf */
+	long len, pos; /* unread entries are buf[pos..len) */
+#else
+	DIR *dir; /* on a dup() of fd */
+#endif
+} dents_t;
+
+dents_t *dents_open(int);
+const char *dents_next(dents_t *, unsigned char *);
+void dents_close(dents_t *);
+
+/* true for "." and "..", which nobody scanning a dir wants */
+#define dents_is_dots(name) \
+	('.' == (name)[0] && ('\0' == (name)[1] || ('.' == (name)[1] && '\0' == (name)[2])))
+
+#ifdef __linux__
+/* a symlink's own perms are always rwxrwxrwx on linux, so DT_LNK alone gives its mode */
+#define DENTS_LNK_MODE	(S_IFLNK | 0777)
+#endif
+
+#endif
+
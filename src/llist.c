@@ -271,6 +271,30 @@ void list_remove(list_head *head, list_node *node, void (*free_data)(void *))
 
 }
 
+/* take a node out of a list without freeing it, the caller owns it again */
+void list_unlink(list_head *head, list_node *node)
+{
+#ifdef DEBUG_LIST
+	assert(NULL != head);
+	assert(NULL != node);
+#endif
+
+	if (node->prev == NULL)
+		head->first = node->next;
+	else
+		node->prev->next = node->next;
+
+	if (node->next == NULL)
+		head->last = node->prev;
+	else
+		node->next->prev = node->prev;
+
+	node->prev = NULL;
+	node->next = NULL;
+
+	head->nodes--;
+}
+
 /* frees entire list and list_head */
 /* returns 1 on success, 0 on failure */
 void list_free(list_head *head, void (*free_data)(void *))
@@ -316,6 +340,18 @@ int list_nodes_free(list_head *head, void (*free_data)(void *))
 
 }
 
+/* empty a list without touching its nodes, for when something else owns them */
+void list_nodes_forget(list_head *head)
+{
+#ifdef DEBUG_LIST
+	assert(NULL != head);
+#endif
+
+	list_first(head) = NULL;
+	list_last(head) = NULL;
+	list_size(head) = 0;
+}
+
 /* print an entire list */
 void list_dump(list_head *head, void (*data_print)(const void *))
 {
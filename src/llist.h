@@ -38,6 +38,7 @@ list_head *list_head_create(); /* create a list */
 void list_free(list_head *, void (*)(void *)); /* free an entire list header and all its node */
 int list_node_free(list_node *, void (*)(void *)); /* free a node using an external function */
 int list_nodes_free(list_head *, void (*)(void *)); /* empty a list, but keep the head */
+void list_nodes_forget(list_head *); /* empty a list, but don't free the nodes, someone else owns them */
 #if 0
 void *list_dupe(void *); /* duplicate an existing list_head* and all nodes */
 #endif
@@ -51,6 +52,7 @@ list_node *list_append(list_head *, list_node *); /* add a node to the end of a
 void *list_node_data(list_node *); /* return pointer to node data */
 void list_remove(list_head *, list_node *, void (*)(void *)); /* remove a node, using an external function to free the node data */
 void list_concat(list_head *, list_head *); /* destructively joins second list to the end of first list */
+void list_unlink(list_head *, list_node *); /* remove a node without freeing it */
 
 /* list examination */
 void list_dump(list_head *, void (*)(const void *)); /* display of a list head and all its node to stdout using an external display function */
@@ -0,0 +1,115 @@
+/* ex: set ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef DEBUG
+#include <assert.h>
+#endif
+#include "lnkcache.h"
+#include "util.h"
+
+#define LNKCACHE_MIN	64 /* slots to start with */
+#define LNKCACHE_MAX	(1 << 16) /* links we hold on to, past that we start over */
+
+#define lnk_hash(dev, ino) \
+	((size_t)((((unsigned long long)(ino) ^ ((unsigned long long)(dev) << 32)) * 0x9e3779b97f4a7c15ULL) >> 32))
+
+static void lnkcache_reset(lnkcache_t *, size_t);
+static lnkent_t *lnkcache_slot(const lnkcache_t *, dev_t, ino_t);
+
+lnkcache_t *lnkcache_alloc(void)
+{
+	lnkcache_t *c = xmalloc(sizeof *c);
+	c->slots = NULL;
+	vec_init(&c->strs, 1, NULL, 0);
+	lnkcache_reset(c, LNKCACHE_MIN);
+	return c;
+}
+
+/* empty c out, with room for nslots */
+static void lnkcache_reset(lnkcache_t *c, size_t nslots)
+{
+	size_t i;
+	xfree(c->slots);
+	c->slots = xmalloc(nslots * sizeof *c->slots);
+	for (i = 0; i < nslots; i++)
+		c->slots[i].target = STROFF_NONE;
+	c->mask = nslots - 1;
+	c->used = 0;
+	vec_clear(&c->strs);
+}
+
+/* where (dev, ino) is, or the empty slot it would go in */
+static lnkent_t *lnkcache_slot(const lnkcache_t *c, dev_t dev, ino_t ino)
+{
+	size_t i;
+	for (i = lnk_hash(dev, ino) & c->mask; STROFF_NONE != c->slots[i].target; i = (i + 1) & c->mask)
+		if (c->slots[i].ino == ino && c->slots[i].dev == dev)
+			break;
+	return &c->slots[i];
+}
+
+/* target of the symlink st is the lstat() of, NULL if we don't know it */
+/* good until the next lnkcache_put() */
+const char *lnkcache_get(const lnkcache_t *c, const struct stat *st)
+{
+	const lnkent_t *ent;
+#ifdef DEBUG
+	assert(NULL != c);
+	assert(NULL != st);
+#endif
+	ent = lnkcache_slot(c, st->st_dev, st->st_ino);
+	if (STROFF_NONE == ent->target
+		|| ent->ctim.tv_sec != st->st_ctim.tv_sec || ent->ctim.tv_nsec != st->st_ctim.tv_nsec
+		|| ent->len != (size_t)st->st_size)
+		return NULL;
+	return strtab_at(&c->strs, ent->target);
+}
+
+/* remember target for the symlink st is the lstat() of */
+/* returns our copy, good until the next lnkcache_put() */
+const char *lnkcache_put(lnkcache_t *c, const struct stat *st, const char *target)
+{
+	lnkent_t *ent;
+	size_t len = strlen(target);
+#ifdef DEBUG
+	assert(NULL != c);
+	assert(NULL != st);
+	assert(NULL != target);
+#endif
+	if (c->used >= LNKCACHE_MAX) /* a batch that never repeats itself, don't hoard */
+		lnkcache_reset(c, c->mask + 1);
+	else if ((c->used + 1) * 2 > c->mask + 1) { /* keep it half empty, move everything over */
+		lnkent_t *old = c->slots, *o;
+		size_t nold = c->mask + 1;
+		c->slots = xmalloc(nold * 2 * sizeof *c->slots);
+		c->mask = nold * 2 - 1;
+		for (ent = c->slots; ent <= &c->slots[c->mask]; ent++)
+			ent->target = STROFF_NONE;
+		for (o = old; o < old + nold; o++)
+			if (STROFF_NONE != o->target)
+				*lnkcache_slot(c, o->dev, o->ino) = *o;
+		xfree(old);
+	}
+	ent = lnkcache_slot(c, st->st_dev, st->st_ino);
+	if (STROFF_NONE == ent->target)
+		c->used++;
+	/* a changed link leaves its old target behind in strs, until the next reset */
+	ent->dev = st->st_dev;
+	ent->ino = st->st_ino;
+	ent->ctim = st->st_ctim;
+	ent->len = len;
+	ent->target = strtab_add(&c->strs, target, len);
+	return strtab_at(&c->strs, ent->target);
+}
+
+void lnkcache_free(lnkcache_t *c)
+{
+	if (NULL == c)
+		return;
+	xfree(c->slots);
+	vec_destroy(&c->strs);
+	xfree(c);
+}
+
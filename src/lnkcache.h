@@ -0,0 +1,40 @@
+/* ex: set ts=4: */
+
+#ifndef LNKCACHE_H
+#define LNKCACHE_H
+
+#include <sys/stat.h>
+#include "vec.h"
+
+/*
+	symlink targets we've already read, by (st_dev, st_ino) of the link.
+	in batch mode the same few links (/usr/lib64, the alternatives,
+	current -> releases/N) come up over and over, path_split() lstat()s
+	them anyway and this saves the readlink() after. an entry only counts
+	if the link's ctime and size still match, a link can't be changed
+	without its ctime moving, so a replaced or reused inode is a miss.
+	only the thread running path_split() touches it.
+*/
+
+typedef struct {
+	dev_t dev;
+	ino_t ino;
+	struct timespec ctim; /* of the link when we read it */
+	stroff_t target; /* in strs, STROFF_NONE if the slot is empty */
+	size_t len; /* of target, st_size of the link */
+} lnkent_t;
+
+typedef struct {
+	lnkent_t *slots; /* open addressing, power of 2 of them */
+	size_t mask; /* slots - 1 */
+	size_t used;
+	vec_t strs; /* targets */
+} lnkcache_t;
+
+lnkcache_t *lnkcache_alloc(void);
+const char *lnkcache_get(const lnkcache_t *, const struct stat *);
+const char *lnkcache_put(lnkcache_t *, const struct stat *, const char *);
+void lnkcache_free(lnkcache_t *);
+
+#endif
+
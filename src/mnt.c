@@ -1,49 +1,32 @@
 
+#define _GNU_SOURCE /* statx */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h> /* open */
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h> /* close */
+#include <sys/stat.h> /* stat, statx */
+#include <sys/sysmacros.h> /* makedev */
 #include "util.h"
 #include "mnt.h"
 
-extern int getsubopt(char **, char * const *, char **);
+#define MNT_READ	65536 /* bytes per read() of the mount table, it can't be read in one go */
 
-/* allocate and return mntpt_t struct */
-mntpt_t *mntpt_alloc(void)
-{
-	mntpt_t *mnt;
-#ifdef DEBUG
-	assert(NULL != mnt);
-#endif
-	mnt = xmalloc(sizeof *mnt);
-	mnt->mntdir = NULL;
-	mnt->mntdev = NULL;
-	return mnt;
-}
+/* high bit of every byte of w that's zero, and maybe of bytes after the */
+/* first one. finds a byte 8 at a time, ctz of it is where the first one is */
+#define MNT_ONES	0x0101010101010101ULL
+#define mnt_zeros(w)	(((w) - MNT_ONES) & ~(w) & (MNT_ONES << 7))
 
-/* initialize a mntpt_t struct */
-/* can also be used to clear out existing mntpt */
-void mntpt_init(mntpt_t *mnt)
-{
-#ifdef DEBUG
-	assert(NULL != mnt);
+static unsigned mnt_opts(const char *);
+static void mnt_perms(mntpt_t *);
+#ifdef __linux__
+static char *mnt_field(char **);
+static long mnt_num(char **, char);
+static void mnt_read(vec_t *, const char *);
+static void mnt_parse(mntlist_t *);
 #endif
-	/* free members if they're allocated */
-	if (NULL != mnt->mntdir) {
-#ifdef DEBUG
-		printf("mntpt_init:%d mnt(%p)->mntdir(%p)\n",
-			__LINE__, (void *)mnt, (void *)mnt->mntdir);
-#endif
-		xfree(mnt->mntdir);
-	}
-	if (NULL != mnt->mntdev) {
-#ifdef DEBUG
-		printf("mntpt_init:%d mnt(%p)->mntdev(%p)\n",
-			__LINE__, (void *)mnt, (void *)mnt->mntdev);
-#endif
-		xfree(mnt->mntdev);
-	}
-	mnt->perms = 0;
-}
 
 /* meant to be used as callback from list_dump() */
 /* may be NULL */
@@ -52,211 +35,577 @@ void mntpt_dump(const void *v)
 	const mntpt_t *mnt = v;
 	printf("\t\tmntpt_t(%p){\n", (void *)mnt);
 	if (NULL != mnt)
-		printf("\t\t\tdir: \"%s\"\n\t\t\tdev: \"%s\"\n\t\t\tperms: %x\n",
-			mnt->mntdir, mnt->mntdev, mnt->perms);
+		printf("\t\t\tid: %d (parent %d)\n\t\t\tdir: \"%s\"\n\t\t\tdev: \"%s\" (%u:%u)\n"
+			"\t\t\troot: \"%s\"\n\t\t\tflags: %x\n\t\t\tperms: %x\n",
+			mnt->id, mnt->parent, mnt->mntdir, mnt->mntdev,
+			(unsigned)major(mnt->dev), (unsigned)minor(mnt->dev), mnt->root, mnt->flags, mnt->perms);
 	printf("\t\t}\n");
 }
 
-/* duplicates mntpt_t, can be used for list's list_node_create_deep */
-void *mntpt_dupe(const void *v)
+/* MNTPT_* for a comma-separated list of mount options, the ones we don't */
+/* care about are skipped. nothing comes back for "rw" and "defaults", */
+/* they're what a mount is without flags */
+static unsigned mnt_opts(const char *opts)
 {
-	const mntpt_t *orig;
-	mntpt_t *dupe;
-#ifdef DEBUG
-	assert(NULL != v);
-#endif
-	orig = v;
-	dupe = mntpt_alloc();
-#if 0
-	mntpt_init(dupe);
+	unsigned flags = 0;
+	const char *end;
+
+	for (; ; opts = end + 1) {
+		for (end = opts; ',' != *end && '\0' != *end; end++)
+			;
+		switch (end - opts) {
+		case 2:
+			if (0 == memcmp(opts, "ro", 2))
+				flags |= MNTPT_RO;
+			break;
+		case 5:
+			if (0 == memcmp(opts, "nodev", 5))
+				flags |= MNTPT_NODEV;
+			break;
+		case 6:
+			if (0 == memcmp(opts, "rdonly", 6))
+				flags |= MNTPT_RO;
+			else if (0 == memcmp(opts, "noexec", 6))
+				flags |= MNTPT_NOEXEC;
+			else if (0 == memcmp(opts, "nosuid", 6))
+				flags |= MNTPT_NOSUID;
+			break;
+		default:
+			break;
+		}
+		if ('\0' == *end)
+			return flags;
+	}
+}
+
+/* what mnt's flags leave anybody able to do on it */
+static void mnt_perms(mntpt_t *mnt)
+{
+	mnt->perms = PERM_READ;
+	if (!(mnt->flags & MNTPT_RO))
+		mnt->perms |= PERM_WRIT;
+	if (!(mnt->flags & MNTPT_NOEXEC))
+		mnt->perms |= PERM_EXEC;
+}
+
+#ifdef __linux__
+
+/*
+	/proc/self/mountinfo, one line per mount in mount order:
+
+	36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw,errors=continue
+	id parent maj:min root mntdir opts [optional fields...] - fstype source superopts
+
+	root, mntdir and source have space, tab, newline and backslash written
+	as octal escapes, so every field ends at a space. the whole table is
+	read into one block and parsed in place: each mount's strings are its
+	fields, terminated and unescaped where they sit. nothing is copied and
+	nothing is malloc()ed per mount.
+*/
+
+/* the field at *p, terminated and unescaped in place, *p moves to the one */
+/* after it. NULL if the line ends first, every field we go through this */
+/* way has more after it */
+static char *mnt_field(char **p)
+{
+	char *field = *p, *in, *out;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	unsigned long long w, hit;
+
+	/* fields are short and there are a lot of them, look for the end a */
+	/* word at a time. mnt_read() leaves room to read past the last one */
+	for (in = field; ; in += 8) {
+		memcpy(&w, in, 8);
+		if (0 != (hit = mnt_zeros(w) | mnt_zeros(w ^ (MNT_ONES * ' ')) | mnt_zeros(w ^ (MNT_ONES * '\\'))))
+			break;
+	}
+	in += __builtin_ctzll(hit) / 8;
+#else
+	for (in = field; ' ' != *in && '\0' != *in && '\\' != *in; in++)
+		;
 #endif
-	if (NULL != orig->mntdir)
-		dupe->mntdir = strdup(orig->mntdir);
-	if (NULL != orig->mntdev)
-		dupe->mntdev = strdup(orig->mntdev);
-	dupe->perms = orig->perms;
-	return dupe;
+	for (out = in; '\\' == *in; ) { /* escapes are rare, copy the rest down over them */
+		if (in[1] >= '0' && in[1] <= '3' && in[2] >= '0' && in[2] <= '7' && in[3] >= '0' && in[3] <= '7') {
+			*out++ = (char)(((in[1] - '0') << 6) | ((in[2] - '0') << 3) | (in[3] - '0'));
+			in += 4;
+		} else {
+			*out++ = *in++;
+		}
+		while (' ' != *in && '\0' != *in && '\\' != *in)
+			*out++ = *in++;
+	}
+	if (' ' != *in)
+		return NULL;
+	*p = in + 1;
+	*out = '\0';
+	return field;
 }
 
-void mntpt_free(void *v)
+/* the number at *p, which has to end with sep, *p moves past sep */
+/* -1 if there's no such number */
+static long mnt_num(char **p, char sep)
 {
+	const char *in = *p;
+	long n = 0;
+
+	if (*in < '0' || *in > '9')
+		return -1;
+	for (; *in >= '0' && *in <= '9'; in++)
+		n = n * 10 + (*in - '0');
+	if (sep != *in)
+		return -1;
+	*p = (char *)in + 1;
+	return n;
+}
+
+/* all of path onto strs, terminated */
+static void mnt_read(vec_t *strs, const char *path)
+{
+	ssize_t got;
+	int fd;
+
+	if (-1 == (fd = open(path, O_RDONLY | O_CLOEXEC)))
+		err_cantopen(__FILE__, __LINE__, path);
+	do {
+		vec_reserve(strs, vec_len(strs) + MNT_READ);
+		while (-1 == (got = read(fd, strtab_at(strs, vec_len(strs)), MNT_READ)))
+			if (EINTR != errno)
+				err_bail(__FILE__, __LINE__, "could not read the mount table");
+		vec_truncate(strs, vec_len(strs) + (size_t)got);
+	} while (got > 0);
+	close(fd);
+	*(char *)vec_push(strs, NULL) = '\0';
+	vec_reserve(strs, vec_len(strs) + 7); /* mnt_field() reads a word at a time */
+}
+
+/* a mntpt_t onto list for every line of the mountinfo in list->strs */
+static void mnt_parse(mntlist_t *list)
+{
+	char *line, *next, *p, *f;
+	long id, parent, maj, min;
 	mntpt_t *mnt;
-#ifdef DEBUG
-	assert(NULL != v);
+
+	for (line = strtab_at(&list->strs, 0); '\0' != *line; line = next) {
+		if (NULL != (next = strchr(line, '\n')))
+			*next++ = '\0';
+		else
+			next = line + strlen(line); /* last line, no newline */
+		p = line;
+		if (-1 == (id = mnt_num(&p, ' ')) || -1 == (parent = mnt_num(&p, ' '))
+			|| -1 == (maj = mnt_num(&p, ':')) || -1 == (min = mnt_num(&p, ' ')))
+			continue; /* not a line we understand, the kernel knows better */
+		mnt = vec_push(&list->mnts, NULL);
+		mnt->id = (int)id;
+		mnt->parent = (int)parent;
+		mnt->dev = makedev((unsigned long)maj, (unsigned long)min);
+		if (NULL == (mnt->root = mnt_field(&p)) || NULL == (mnt->mntdir = mnt_field(&p))
+			|| NULL == (f = mnt_field(&p)))
+			goto bad;
+		mnt->flags = mnt_opts(f);
+		/* shared:N and friends, up to the "-" */
+		while (!('-' == p[0] && ' ' == p[1]))
+			if (NULL == mnt_field(&p))
+				goto bad;
+		p += 2;
+		if (NULL == mnt_field(&p) /* fstype */ || NULL == (mnt->mntdev = mnt_field(&p)))
+			goto bad;
+		/* the fs's own options lead with ro or rw, and a read-only fs is */
+		/* read-only wherever it's mounted. the rest can be long (overlay */
+		/* layers), nothing in them matters to us */
+		if ('r' == p[0] && 'o' == p[1] && (',' == p[2] || '\0' == p[2]))
+			mnt->flags |= MNTPT_RO;
+		mnt_perms(mnt);
+		continue;
+bad:
+		vec_pop(&list->mnts);
+	}
+}
+
+/* every mount in our namespace, from /proc/self/mountinfo */
+mntlist_t * mnt_load(void)
+{
+	mntlist_t *list = xmalloc(sizeof *list);
+	vec_init(&list->mnts, sizeof(mntpt_t), NULL, 0);
+	vec_init(&list->strs, 1, NULL, 0);
+	mnt_read(&list->strs, "/proc/self/mountinfo");
+	mnt_parse(list);
+	return list;
+}
+
+#else /* no mountinfo, go by fstab */
+
+/* every mount in fstab, which is the best we can do here */
+mntlist_t * mnt_load(void)
+{
+	mntlist_t *list = xmalloc(sizeof *list);
+	struct fstab *fs_ent;
+	vec_t offs; /* stroff_t, mntdir and mntdev of each mount */
+	stroff_t root;
+	mntpt_t *mnt;
+	size_t i;
+
+	vec_init(&list->mnts, sizeof(mntpt_t), NULL, 0);
+	vec_init(&list->strs, 1, NULL, 0);
+	vec_init(&offs, sizeof(stroff_t), NULL, 0);
+	root = strtab_add(&list->strs, "/", 1);
+
+	if (0 == setfsent())
+		err_bail(__FILE__, __LINE__, "setfsent() failed, can't read mount file");
+	while (NULL != (fs_ent = getfsent())) {
+		*(stroff_t *)vec_push(&offs, NULL) = strtab_add(&list->strs, fs_ent->fs_file, strlen(fs_ent->fs_file));
+		*(stroff_t *)vec_push(&offs, NULL) = strtab_add(&list->strs, fs_ent->fs_spec, strlen(fs_ent->fs_spec));
+		mnt = vec_push(&list->mnts, NULL);
+		mnt->id = mnt->parent = -1;
+		mnt->flags = mnt_opts(fs_ent->fs_mntops);
+		mnt_perms(mnt);
+	}
+	endfsent();
+
+	/* strs is done growing, the strings stay put now */
+	for (i = 0; i < vec_len(&list->mnts); i++) {
+		mnt = vec_ptr(&list->mnts, mntpt_t, i);
+		mnt->mntdir = strtab_at(&list->strs, vec_at(&offs, stroff_t, i * 2));
+		mnt->mntdev = strtab_at(&list->strs, vec_at(&offs, stroff_t, i * 2 + 1));
+		mnt->root = strtab_at(&list->strs, root);
+	}
+	vec_destroy(&offs);
+	return list;
+}
+
 #endif
-	mnt = v;
-	if (NULL == mnt)
+
+/* free what mnt_load() returned */
+void mnt_unload(mntlist_t *list)
+{
+	if (NULL == list)
 		return;
-	xfree(mnt->mntdir);
-	xfree(mnt->mntdev);
-	xfree(mnt);
+	vec_destroy(&list->mnts);
+	vec_destroy(&list->strs);
+	xfree(list);
 }
 
-/* copying info about system mounts into a list */
-list_head * mnt_load(void)
+/* same mounts, in the same order, with the same flags */
+int mnt_same(const mntlist_t *a, const mntlist_t *b)
 {
+	const mntpt_t *ma, *mb;
+	if (vec_len(&a->mnts) != vec_len(&b->mnts))
+		return 0;
+	for (ma = vec_first(&a->mnts, mntpt_t), mb = vec_first(&b->mnts, mntpt_t); ma < vec_end(&a->mnts, mntpt_t); ma++, mb++)
+		if (ma->id != mb->id || ma->flags != mb->flags || ma->dev != mb->dev
+			|| 0 != strcmp(ma->mntdir, mb->mntdir) || 0 != strcmp(ma->mntdev, mb->mntdev)
+			|| 0 != strcmp(ma->root, mb->root))
+			return 0;
+	return 1;
+}
 
-	list_head *list; /* list we'll be returning */
-	list_node *node; /* list node */
-#ifdef SHAC_MNTFILE
-	FILE *mnt_fp; /* fp from mtab */
-	struct mntent *mnt_ent; /* mntpt entries from mtab */
+/*
+	linux says POLLPRI (and POLLERR) on an open /proc/self/mountinfo once
+	anything is mounted or unmounted in our namespace, and again for the
+	next change after poll() has told us. so something that stays up can
+	check for new mounts with one syscall instead of reading the table.
+*/
+
+/* an fd for mnt_changed(), -1 if there's no way to tell */
+int mnt_watch(void)
+{
+#ifdef __linux__
+	return open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
 #else
-	struct fstab *fs_ent;
+	return -1;
 #endif
+}
+
+/* whether the mount table has changed since mnt_watch(), or since */
+/* the last time this said so */
+int mnt_changed(int fd)
+{
+	struct pollfd pfd;
+	if (-1 == fd)
+		return 0;
+	pfd.fd = fd;
+	pfd.events = POLLPRI;
+	pfd.revents = 0;
+	return (1 == poll(&pfd, 1, 0) && (pfd.revents & (POLLPRI | POLLERR)));
+}
+
+/*
+	a mount covers its mntdir and everything under it, unless something
+	mounted later sits on the same dir or one above it. so the mount a path
+	is on is the latest of the mounts found walking its components from "/",
+	which is what a walk down this trie collects. each node is one component
+	of some mntdir, with the latest mount exactly there if there is one.
+	children of every node live in one hash table keyed on (parent, name),
+	so a step costs the same with 20 mounts or 20,000.
+*/
+struct mnttrie {
+	mnttrie_t *parent;
+	mnttrie_t *next; /* bucket chain */
+	mntpt_t *mnt; /* latest mount exactly here, if any */
+	size_t len;
+	char name[]; /* not terminated, len long */
+};
+
+/* st_dev of a visible mount, mnt is NULL if more than one shares it (bind mounts) */
+struct mntdev {
+	dev_t dev;
 	mntpt_t *mnt;
-	char *subopts, *suboptval;
-	enum {
-		OPT_RO = 0, /* read only */
-		OPT_RW, /* explict read and writable */
-		OPT_RDONLY, /* "rdonly" for freebsd */
-		OPT_NOEXEC, /* noexec option */
-		OPT_DEFAULTS /* defaults, assuming rwx */
-	};
-	char * const mount_opts[] = {
-		"ro",
-		"rw",
-		"rdonly",
-		"noexec",
-		"defaults",
-		NULL
-	};
-
-	/* init list */
-	if (NULL == (list = list_head_create()))
-		err_bail(__FILE__, __LINE__, "could not create list");
+	int used;
+};
 
-#ifdef DEBUG
-#ifdef SHAC_MNTFILE
-	printf("mnt_load:%d SHAC_MNTFILE: \"%s\"\n", __LINE__, SHAC_MNTFILE);
-#endif
-#endif
+static size_t mnttrie_hash(const mnttrie_t *parent, const char *name, size_t len)
+{
+	size_t h = (size_t)parent ^ 2166136261u;
+	while (len-- > 0)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	return h;
+}
 
-	mnt = mntpt_alloc(); /* make room */
-
-/* if this is glibc, open file explicitly... */
-#ifdef LINUX
-	/* open mtab or die trying */
-	if (NULL == (mnt_fp = setmntent(SHAC_MNTFILE, "r")))
-		err_cantopen(__FILE__, __LINE__, SHAC_MNTFILE);
-	/* read each mtab entry and copy what we need out of it */
-	while (NULL != (mnt_ent = getmntent(mnt_fp))) {
-		mntpt_init(mnt); /* clear out mnt */
-		if (NULL == (mnt->mntdir = strdup(mnt_ent->mnt_dir)))
-			err_bail(__FILE__, __LINE__, "could not strdup mnt_ent->mnt_dir");
-		if (NULL == (mnt->mntdev = strdup(mnt_ent->mnt_fsname)))
-			err_bail(__FILE__, __LINE__, "could not strdup mnt_ent->mnt_dev");
-		/* read mount subopts */
-		subopts = mnt_ent->mnt_opts;
-#else /* if this is FreeBSD (and others?) use this: */
-		/* freebsd doesn't define the file, we just call setgrent */
-		if (0 == setfsent())
-			err_bail(__FILE__, __LINE__, "setgrent() failed, can't read mount file");
-		while (NULL != (fs_ent = getfsent())) {
-			mntpt_init(mnt);
-			if (NULL == (mnt->mntdir = strdup(fs_ent->fs_file)))
-				err_bail(__FILE__, __LINE__, "could not strdup fs_ent->fs_file");
-			if (NULL == (mnt->mntdev = strdup(fs_ent->fs_spec)))
-				err_bail(__FILE__, __LINE__, "could not strdup fs_ent->fs_spec");
-			/* read mount subopts */
-			subopts = fs_ent->fs_mntops;
-#endif
+/* dev_t packs major and minor into odd bits, spread them out */
+#define mntdev_hash(dev)	((size_t)(((unsigned long long)(dev) * 0x9e3779b97f4a7c15ULL) >> 32))
+/* ids are handed out low and close together, but not in order */
+#define mntid_hash(id)		((size_t)(((unsigned long long)(unsigned)(id) * 0x9e3779b97f4a7c15ULL) >> 32))
 
-#ifdef DEBUG
-#if 1
-			printf("mnt_load()%d: mnt:\n", __LINE__);
-			mntpt_dump(mnt);
-#endif
-#endif
+static mnttrie_t *mnttrie_child(const mnttab_t *tab, const mnttrie_t *parent, const char *name, size_t len)
+{
+	mnttrie_t *node;
+	node = tab->buckets[mnttrie_hash(parent, name, len) & (tab->nbuckets - 1)];
+	for (; NULL != node; node = node->next)
+		if (node->parent == parent && node->len == len && 0 == memcmp(node->name, name, len))
+			return node;
+	return NULL;
+}
 
-			while ('\0' != *subopts) {
-#ifdef DEBUG
-				printf("mnt_load()%d: subopts(%p) \"%s\"\n",
-					__LINE__, (void *)subopts, subopts);
-#endif
-				switch (getsubopt(&subopts, mount_opts, &suboptval)) {
-				case OPT_RO:
-				case OPT_RDONLY:
-#ifdef DEBUG
-#if 1
-					printf("mnt_load()%d:OPT_(RO|RDONLY)!\n", __LINE__);
-#endif
-#endif
-					mnt->perms |= PERM_READ; /* reading allowed */
-					mnt->perms &= (PERM_MASK ^ PERM_WRIT); /* writing disallowed */
-					break;
-				case OPT_NOEXEC:
-#ifdef DEBUG
-#if 1
-					printf("mnt_load()%d:OPT_NOEXEC!\n", __LINE__);
-#endif
-#endif
-					mnt->perms &= (PERM_MASK ^ PERM_EXEC); /* exec disallowed */
-					break;
-				case OPT_RW:
-#ifdef DEBUG
-#if 1
-					printf("mnt_load()%d:OPT_RW!\n", __LINE__);
-#endif
-#endif
-				/* fall through... */
-				case OPT_DEFAULTS: /* we'll assume default is rw */
+static mnttrie_t *mnttrie_add(mnttab_t *tab, mnttrie_t *parent, const char *name, size_t len)
+{
+	mnttrie_t *node;
+	size_t b;
+	if (NULL != (node = mnttrie_child(tab, parent, name, len)))
+		return node;
+	node = xmalloc(sizeof *node + len);
+	node->parent = parent;
+	node->mnt = NULL;
+	node->len = len;
+	memcpy(node->name, name, len);
+	b = mnttrie_hash(parent, name, len) & (tab->nbuckets - 1);
+	node->next = tab->buckets[b];
+	tab->buckets[b] = node;
+	return node;
+}
+
+/* index mnts, which is in mount order and stays the caller's until mnttab_free() */
+mnttab_t *mnttab_alloc(vec_t *mnts)
+{
+	mnttab_t *tab;
+	mntpt_t *mnt;
+	size_t comps = 1;
+	unsigned seq = 0;
+	const char *p;
 #ifdef DEBUG
-#if 1
-					printf("mnt_load()%d:OPT_DEFAULTS!\n", __LINE__);
-#endif
+	assert(NULL != mnts);
 #endif
-					mnt->perms |= PERM_READ; /* reading allowed */
-					mnt->perms |= PERM_WRIT; /* writing allowed */
-					break;
-				default:
-					break;
-				}
-				/* mnt now complete, goes onto the list */
-				/* first make a duplicate */
-			}
-			/* subopts read */
-			/* create copy of mnt */
-			node = list_node_create_deep(mnt, mntpt_dupe);
-			/* append node to list */
-			if (NULL == list_append(list, node))
-				err_bail(__FILE__, __LINE__, "could not append mnt to list");
+	/* every component of every mntdir is at most one node */
+	for (mnt = vec_first(mnts, mntpt_t); mnt < vec_end(mnts, mntpt_t); mnt++)
+		for (p = mnt->mntdir; '\0' != *p; p++)
+			if (PATHSEP == *p)
+				comps++;
 
+	tab = xmalloc(sizeof *tab);
+	tab->mnts = mnts;
+	for (tab->nbuckets = 16; tab->nbuckets < comps * 2; tab->nbuckets <<= 1)
+		;
+	tab->buckets = xmalloc(tab->nbuckets * sizeof *tab->buckets);
+	memset(tab->buckets, 0, tab->nbuckets * sizeof *tab->buckets);
+	tab->root = xmalloc(sizeof *tab->root);
+	tab->root->parent = tab->root->next = NULL;
+	tab->root->mnt = NULL;
+	tab->root->len = 0;
+	tab->devs = NULL;
+	tab->ndevs = 0;
+	tab->devs_ready = 0;
+	pthread_mutex_init(&tab->devs_lock, NULL);
+	for (tab->nids = 16; tab->nids < vec_len(mnts) * 2; tab->nids <<= 1)
+		;
+	tab->ids = xmalloc(tab->nids * sizeof *tab->ids);
+	memset(tab->ids, 0, tab->nids * sizeof *tab->ids);
+
+	for (mnt = vec_first(mnts, mntpt_t); mnt < vec_end(mnts, mntpt_t); mnt++) {
+		mnttrie_t *at = tab->root;
+		size_t i;
+		mnt->seq = ++seq;
+		if (-1 != mnt->id) {
+			for (i = mntid_hash(mnt->id) & (tab->nids - 1); NULL != tab->ids[i]; i = (i + 1) & (tab->nids - 1))
+				;
+			tab->ids[i] = mnt;
+		}
+		if (PATHSEP != mnt->mntdir[0])
+			continue; /* "none", "swap" and friends aren't anywhere */
+		for (p = mnt->mntdir; '\0' != *p; ) {
+			size_t len;
+			while (PATHSEP == *p)
+				p++;
+			if ('\0' == *p)
+				break;
+			for (len = 0; '\0' != p[len] && PATHSEP != p[len]; len++)
+				;
+			at = mnttrie_add(tab, at, p, len);
+			p += len;
 		}
+		at->mnt = mnt; /* later mounts on the same dir cover earlier ones */
+	}
 
-#ifdef SHAC_MNTFILE
-	/* close mtab */
-	endmntent(mnt_fp);
-#else
-	endfsent();
+	return tab;
+}
+
+void mnttab_free(mnttab_t *tab)
+{
+	size_t i;
+	if (NULL == tab)
+		return;
+	for (i = 0; i < tab->nbuckets; i++) {
+		mnttrie_t *node = tab->buckets[i], *next;
+		for (; NULL != node; node = next) {
+			next = node->next;
+			xfree(node);
+		}
+	}
+	xfree(tab->buckets);
+	xfree(tab->root);
+	xfree(tab->devs);
+	xfree(tab->ids);
+	pthread_mutex_destroy(&tab->devs_lock);
+	xfree(tab);
+}
+
+/* take one step of a walk down from "/", which also (re)starts it */
+/* name is a single path component, len long */
+void mnttab_step(const mnttab_t *tab, mntcur_t *cur, const char *name, size_t len)
+{
+	mntpt_t *mnt;
+#ifdef DEBUG
+	assert(NULL != tab);
+	assert(NULL != cur);
+#endif
+	if (1 == len && PATHSEP == name[0]) {
+		cur->node = tab->root;
+		cur->mnt = tab->root->mnt;
+		return;
+	}
+	if (NULL == cur->node)
+		return; /* nothing mounted down here */
+	cur->node = mnttrie_child(tab, cur->node, name, len);
+	if (NULL != cur->node && NULL != (mnt = cur->node->mnt))
+		if (NULL == cur->mnt || mnt->seq > cur->mnt->seq)
+			cur->mnt = mnt; /* not covered by anything mounted above */
+}
+
+/* the mount path is on, NULL if nothing covers it */
+mntpt_t *mnttab_find(const mnttab_t *tab, const char *path)
+{
+	mntcur_t cur;
+	const char *p = path;
+#ifdef DEBUG
+	assert(NULL != tab);
+	assert(NULL != path);
 #endif
+	if (PATHSEP != *p)
+		return NULL;
+	mnttab_step(tab, &cur, p, 1);
+	while (NULL != cur.node && '\0' != *p) {
+		size_t len;
+		while (PATHSEP == *p)
+			p++;
+		for (len = 0; '\0' != p[len] && PATHSEP != p[len]; len++)
+			;
+		if (len > 0)
+			mnttab_step(tab, &cur, p, len);
+		p += len;
+	}
+	return cur.mnt;
+}
 
-	mntpt_free(mnt);
+/* fill in tab->devs with every mount that isn't covered */
+/* left until someone asks, a mount the kernel didn't give a dev for gets */
+/* stat()ed, and a dead nfs server hangs the stat() */
+static void mnttab_devs_load(mnttab_t *tab)
+{
+	mntpt_t *mnt;
 
-	return list;
+	for (tab->ndevs = 16; tab->ndevs < vec_len(tab->mnts) * 2; tab->ndevs <<= 1)
+		;
+	tab->devs = xmalloc(tab->ndevs * sizeof *tab->devs);
+	memset(tab->devs, 0, tab->ndevs * sizeof *tab->devs);
 
+	for (mnt = vec_first(tab->mnts, mntpt_t); mnt < vec_end(tab->mnts, mntpt_t); mnt++) {
+		struct stat st;
+		size_t i;
+		if (mnt != mnttab_find(tab, mnt->mntdir))
+			continue; /* covered, or not a dir at all */
+		if (0 != mnt->dev)
+			st.st_dev = mnt->dev;
+		else if (-1 == stat(mnt->mntdir, &st))
+			continue;
+		for (i = mntdev_hash(st.st_dev) & (tab->ndevs - 1); tab->devs[i].used; i = (i + 1) & (tab->ndevs - 1))
+			if (tab->devs[i].dev == st.st_dev)
+				break;
+		if (tab->devs[i].used) {
+			tab->devs[i].mnt = NULL; /* bind mount, dev alone won't tell them apart */
+		} else {
+			tab->devs[i].used = 1;
+			tab->devs[i].dev = st.st_dev;
+			tab->devs[i].mnt = mnt;
+		}
+	}
 }
 
-int mntpt_mntdir_cmp(const void *mnt, const void *find)
+/* the one visible mount whose files have st_dev dev */
+/* NULL if there's none or more than one, go by path then */
+mntpt_t *mnttab_dev(mnttab_t *tab, dev_t dev)
 {
+	size_t i;
 #ifdef DEBUG
-	assert(NULL != mnt);
-	assert(NULL != find);
-#if 0
-	printf("mntpt_mntdir_cmp()%d mnt(%p)->mntdir: \"%s\", find(%p) \"%s\"\n",
-		__LINE__, mnt, ((mntpt_t *)mnt)->mntdir, find, (char *)find);
+	assert(NULL != tab);
 #endif
+	if (!__atomic_load_n(&tab->devs_ready, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&tab->devs_lock);
+		if (!tab->devs_ready) {
+			mnttab_devs_load(tab);
+			__atomic_store_n(&tab->devs_ready, 1, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&tab->devs_lock);
+	}
+	for (i = mntdev_hash(dev) & (tab->ndevs - 1); tab->devs[i].used; i = (i + 1) & (tab->ndevs - 1))
+		if (tab->devs[i].dev == dev)
+			return tab->devs[i].mnt;
+	return NULL;
+}
+
+/* the mount with kernel mount ID id, NULL if it's not one we know */
+mntpt_t *mnttab_id(const mnttab_t *tab, int id)
+{
+	size_t i;
+#ifdef DEBUG
+	assert(NULL != tab);
 #endif
-	return strcmp(((mntpt_t *)mnt)->mntdir, (char *)find);
+	for (i = mntid_hash(id) & (tab->nids - 1); NULL != tab->ids[i]; i = (i + 1) & (tab->nids - 1))
+		if (tab->ids[i]->id == id)
+			return tab->ids[i];
+	return NULL;
 }
 
-mntpt_t *mnt_mntdir_find(list_head *mnts, const char *path)
+/* the mount name in dirfd is on, not following it if it's a symlink */
+/* the kernel says which by mount ID, so bind mounts of the same dev are */
+/* told apart and no mount has to be stat()ed. NULL if it won't say */
+mntpt_t *mnttab_at(const mnttab_t *tab, int dirfd, const char *name)
 {
-	void * search = NULL;
+#ifdef STATX_MNT_ID
+	struct statx stx;
 #ifdef DEBUG
-	assert(NULL != mnts);
-	assert(NULL != path);
+	assert(NULL != tab);
+	assert(NULL != name);
+#endif
+	if (0 == statx(dirfd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_MNT_ID, &stx)
+		&& (stx.stx_mask & STATX_MNT_ID))
+		return mnttab_id(tab, (int)stx.stx_mnt_id);
 #endif
-	search = list_search(list_first(mnts), mntpt_mntdir_cmp, path);
-	return (mntpt_t *)list_node_data(search);
+	return NULL;
 }
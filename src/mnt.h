@@ -5,16 +5,23 @@
 #include "shac.h"
 
 /* mntpt_t functions */
-mntpt_t *mntpt_alloc(void);
-void mntpt_init(mntpt_t *);
 void mntpt_dump(const void *);
-void *mntpt_dupe(const void *);
-void mntpt_free(void *);
 
 /* mount functions */
-list_head *mnt_load(void);
-int mntpt_mntdir_cmp(const void *, const void *);
-mntpt_t *mnt_mntdir_find(list_head *, const char *);
+mntlist_t *mnt_load(void);
+void mnt_unload(mntlist_t *);
+int mnt_same(const mntlist_t *, const mntlist_t *);
+int mnt_watch(void);
+int mnt_changed(int);
+
+/* mount index */
+mnttab_t *mnttab_alloc(vec_t *);
+void mnttab_free(mnttab_t *);
+void mnttab_step(const mnttab_t *, mntcur_t *, const char *, size_t);
+mntpt_t *mnttab_find(const mnttab_t *, const char *);
+mntpt_t *mnttab_dev(mnttab_t *, dev_t);
+mntpt_t *mnttab_id(const mnttab_t *, int);
+mntpt_t *mnttab_at(const mnttab_t *, int, const char *);
 
 #endif
 
@@ -1,9 +1,13 @@
 /* ex: set ts=4: */
 
+#define _GNU_SOURCE /* O_PATH */
+
 #include <stdio.h>
 #include <string.h>
 #include <sys/param.h> /* MAXSYMLINKS */
 #include <errno.h>
+#include <fcntl.h> /* openat, fstatat, AT_* */
+#include <unistd.h> /* close */
 #include "mnt.h"
 #include "path.h"
 #include "util.h"
@@ -15,13 +19,6 @@ path_t * path_alloc(void)
 #ifdef DEBUG
 	printf("%s:%d:path:%p\n", __FILE__, __LINE__, (void *)path);
 #endif
-	/* set all pointers to NULL explicitly, because if we alloc and there's junk floating around
-	init will think it's an allocated pointer and try to free it */
-	path->abspath = NULL;
-	path->dir = NULL;
-	path->component = NULL;
-	path->symlink = NULL;
-	path->mntpt = NULL;
 	path_init(path);
 	return path;
 }
@@ -31,86 +28,29 @@ void path_init(path_t *path)
 {
 	if (NULL == path)
 		return;
-#ifdef DEBUG
-	printf("path_init:%d(%p)\n", __LINE__, (void *)path);
-	path_dump(path);
-#endif
-	xfree(path->abspath);
-		path->abspath = NULL;
-	xfree(path->dir);
-		path->dir = NULL;
-	xfree(path->component);
-		path->component = NULL;
-	xfree(path->symlink);
-		path->symlink = NULL;
 	path->uid = USER_NONE;
 	path->gid = GROUP_NONE;
 	path->mode = 0;
 	path->status = 0;
+	path->flags = 0;
 	path->mntpt = NULL; /* don't free mntpt, it's not ours */
 }
 
-void * path_dupe(const void *v)
-{
-	const path_t *orig;
-	path_t *dupe;
-#ifdef DEBUG
-	assert(NULL != v);
-#endif
-	if (NULL == v)
-		err_bail(__FILE__, __LINE__, "trying to duplicate a NULL path!");
-	orig = v; /* pointer passed is to a path_t */
-	dupe = path_alloc(); /* allocate new path_t */
-	if (NULL != orig->abspath)
-		dupe->abspath = strdup(orig->abspath);
-	if (NULL != orig->dir)
-		dupe->dir = strdup(orig->dir);
-	if (NULL != orig->component)
-		dupe->component = strdup(orig->component);
-	if (NULL != orig->symlink)
-		dupe->symlink = strdup(orig->symlink);
-	dupe->mode = orig->mode;
-	dupe->uid = orig->uid;
-	dupe->gid = orig->gid;
-	dupe->status = orig->status;
-#if 0
-	if (NULL != orig->mntpt)
-		dupe->mntpt = mntpt_dupe(orig->mntpt);
-#endif
-	/* don't want to actually copy mntpt, just point to original copy */
-	dupe->mntpt = orig->mntpt;
-	return dupe;
-}
-
-/* callback for list_node_free to free path_t */
 void path_free(void *v)
 {
-	path_t *p;
-	if (NULL == v)
-		return;
-	p = v;
-	path_init(p); /* clears sub-items */
-	xfree(p);
+	xfree(v);
 }
 
-/* callback for list_dump to inspect a path_t */
+/* inspect a path_t */
 void path_dump(const void *v)
 {
 	const path_t *p;
-#ifdef DEBUG
-#if 0
-	printf("path_dump(%p)\n", v);
-#endif
-#endif
 	p = v;
 	/* these are all split up because i was getting segfaults on invalid path_ts */
 	printf("\tpath_t(%p){\n", (void *)p);
 	if (NULL != p) { /* handle NULLs ok */
-		printf("\t\tabspath(%p): \"%s\"\n", (void *)p->abspath, p->abspath);
-		printf("\t\tdir(%p): \"%s\"\n", (void *)p->dir, p->dir);
-		printf("\t\tcomponent(%p): \"%s\"\n", (void *)p->component, p->component);
-		printf("\t\tsymlink(%p): \"%s\"\n", (void *)p->symlink, p->symlink);
-		printf("\t\tuid: %d\n\t\tgid: %d\n\t\tstatus: %d\n\t\tmode: %d\n", p->uid, p->gid, p->status, p->mode);
+		printf("\t\tuid: %d\n\t\tgid: %d\n\t\tstatus: %d\n\t\tflags: %d\n\t\tmode: %d\n",
+			p->uid, p->gid, p->status, p->flags, p->mode);
 		printf("\t\t\tur:%d, uw:%d, ux:%d, us:%d, gr:%d, gw:%d, gx:%d, gs:%d, or:%d, ow:%d, ox:%d, sb:%d\n",
 			p->mode & S_IRUSR, p->mode & S_IWUSR, p->mode & S_IXUSR, p->mode & S_ISUID,
 			p->mode & S_IRGRP, p->mode & S_IWGRP, p->mode & S_IXGRP, p->mode & S_ISGID,
@@ -123,382 +63,629 @@ void path_dump(const void *v)
 	printf("\t}\n");
 }
 
+/*************************** pathvec_t functions ****************************/
+
+/* an empty pathvec_t, mallocs from the first push */
+void pathvec_init(pathvec_t *pv)
+{
+	vec_init(&pv->paths, sizeof(path_t), NULL, 0);
+	vec_init(&pv->names, sizeof(pathname_t), NULL, 0);
+	vec_init(&pv->strs, 1, NULL, 0);
+}
+
+/* an empty pathvec_t that starts on its own inline room */
+void pathvec_init_small(pathvec_small_t *s)
+{
+	vec_init(&s->pv.paths, sizeof(path_t), s->paths, PATHVEC_INLINE);
+	vec_init(&s->pv.names, sizeof(pathname_t), s->names, PATHVEC_INLINE);
+	vec_init(&s->pv.strs, 1, s->strs, sizeof s->strs);
+}
+
+void pathvec_destroy(pathvec_t *pv)
+{
+	if (NULL == pv)
+		return;
+	vec_destroy(&pv->paths);
+	vec_destroy(&pv->names);
+	vec_destroy(&pv->strs);
+}
+
+/* add path with names name, whose offsets are already in pv->strs */
+/* returns the new path_t, good until the next push */
+path_t *pathvec_push(pathvec_t *pv, const path_t *path, const pathname_t *name)
+{
+	vec_push(&pv->names, name);
+	return vec_push(&pv->paths, path);
+}
+
+/* add src's i'th path to pv, along with copies of its names */
+path_t *pathvec_copy(pathvec_t *pv, const pathvec_t *src, size_t i)
+{
+	const pathname_t *from = pathvec_name(src, i);
+	pathname_t name;
+	const char *str;
+#ifdef DEBUG
+	assert(pv != src);
+#endif
+	name.abspath = name.component = name.symlink = STROFF_NONE;
+	if (NULL != (str = pathvec_str(src, from->abspath)))
+		name.abspath = strtab_add(&pv->strs, str, strlen(str));
+	if (NULL != (str = pathvec_str(src, from->component)))
+		name.component = strtab_add(&pv->strs, str, strlen(str));
+	if (NULL != (str = pathvec_str(src, from->symlink)))
+		name.symlink = strtab_add(&pv->strs, str, strlen(str));
+	return pathvec_push(pv, pathvec_path(src, i), &name);
+}
+
+/* give back the strings added to pv since vec_len(&pv->strs) was mark */
+/* abspaths path_chain_abspath() built in them are forgotten, it rebuilds them */
+void pathvec_release(pathvec_t *pv, size_t mark)
+{
+	pathname_t *name;
+	/* it fills in a run of entries up to one that had an abspath, so the */
+	/* ones built since mark are at the end */
+	for (name = vec_end(&pv->names, pathname_t); name-- > vec_first(&pv->names, pathname_t); ) {
+		if (STROFF_NONE == name->abspath || name->abspath < mark)
+			break;
+		name->abspath = STROFF_NONE;
+	}
+	vec_truncate(&pv->strs, mark);
+}
+
+/* display a pathvec_t, names and all */
+void pathvec_dump(const pathvec_t *pv)
+{
+	size_t i;
+	printf("pathvec_t(%p){ %d\n", (void *)pv, (int)pathvec_len(pv));
+	for (i = 0; i < pathvec_len(pv); i++) {
+		printf("\tabspath: \"%s\"\n\tcomponent: \"%s\"\n\tsymlink: \"%s\"\n",
+			pathvec_abspath(pv, i), pathvec_component(pv, i),
+			pathvec_str(pv, pathvec_name(pv, i)->symlink));
+		path_dump(pathvec_path(pv, i));
+	}
+	printf("}\n");
+}
+
 
 /*********************** "algorithm" functions ******************************/
 
+/* an empty pathtok_t, starts on its own inline room */
+void pathtok_init(pathtok_t *tok)
+{
+	vec_init(&tok->buf, 1, tok->bufinl, sizeof tok->bufinl);
+	vec_init(&tok->comps, sizeof(pathtok_comp_t), tok->compsinl,
+		sizeof tok->compsinl / sizeof(pathtok_comp_t));
+}
+
+void pathtok_destroy(pathtok_t *tok)
+{
+	if (NULL == tok)
+		return;
+	vec_destroy(&tok->buf);
+	vec_destroy(&tok->comps);
+}
+
+/* display what path_calc_target() made */
+void path_target_dump(const pathtok_t *tok)
+{
+	size_t i;
+	printf("target(%p){ ", (void *)tok);
+	for (i = 0; i < pathtok_len(tok); i++)
+		printf("\"%s\" ", pathtok_str(tok, i));
+	printf("}\n");
+}
+
 /* suppled could be dirty, we need to figure out if it's absolute, if it's not... */
 /* we combine it with cwd */
 /* if it is, we just clean it up */
-list_head *path_calc_target(const char *supplied, const char *cwd)
+/* replaces whatever tok held with the components, "/" first */
+/* ".." above "/" stays at "/", like the kernel does */
+void path_calc_target(pathtok_t *tok, const char *supplied, const char *cwd)
 {
-	list_head *list = NULL;
-	list_node *node = NULL;
-	char *path = NULL, *pos1 = NULL, *pos2 = NULL, *end = NULL;
-	char *tmp = NULL;
-	int len = 0;
+	pathtok_comp_t *comp;
+	size_t slen, clen = 0;
+	char *path, *pos, *next, *end;
 
 #ifdef DEBUG
+	assert(NULL != tok);
 	assert(NULL != supplied);
 	printf("path_calc_target ---------------\n");
 #endif
 
-	if (*supplied != PATHSEP) { /* non-absolute path */
-#ifdef DEBUG
-		printf("path_calc_target():%d supplied: \"%s\", cwd \"%s\"\n",__LINE__,
-			supplied, cwd);
-#endif
-		tmp = strchr(cwd, '\0');
-#ifdef DEBUG
-		printf("path_calc_target():%d allocating %d bytes for path\n",
-			__LINE__, (tmp - cwd) + strlen(supplied) + 1 + 1);
-#endif
-		path = xmalloc((tmp - cwd) + strlen(supplied) + 1 + 1);
-		strncpy(path, cwd, tmp - cwd);
-		tmp = path + (tmp - cwd); /* set tmp at the end of path */
-		*tmp++ = PATHSEP; /* add sep */
-		strcpy(tmp, supplied);
-#ifdef DEBUG
-	printf("path_calc_target:%d path: \"%s\"\n", __LINE__, path);
-#endif
-	} else { /* absolute path */
-		if (NULL == (path = strdup(supplied)))
-			err_bail(__FILE__, __LINE__, "could not duplicate supplied into path");
+	if (*supplied != PATHSEP && NULL != cwd) /* non-absolute path */
+		clen = strlen(cwd);
+	slen = strlen(supplied);
+
+	/* "/", then cwd and supplied joined up, in one go */
+	vec_clear(&tok->buf);
+	vec_clear(&tok->comps);
+	vec_reserve(&tok->buf, 2 + clen + 1 + slen + 1);
+	path = vec_first(&tok->buf, char);
+	path[0] = PATHSEP;
+	path[1] = '\0';
+	end = path + 2;
+	memcpy(end, cwd, clen);
+	end += clen;
+	*end++ = PATHSEP;
+	memcpy(end, supplied, slen);
+	end += slen;
+	*end = '\0';
+	vec_truncate(&tok->buf, end + 1 - path);
+
+	comp = vec_push(&tok->comps, NULL);
+	comp->off = 0;
+	comp->len = 1;
+
+	/* cut at each sep, dropping empty and "." components and backing up on ".." */
+	for (pos = path + 2; pos < end; pos = next + 1) {
+		size_t len;
+		for (next = pos; next < end && PATHSEP != *next; next++)
+			;
+		*next = '\0';
+		len = next - pos;
+		if (0 == len || (1 == len && '.' == pos[0]))
+			continue;
+		if (2 == len && '.' == pos[0] && '.' == pos[1]) {
+			if (pathtok_len(tok) > 1)
+				vec_pop(&tok->comps);
+			continue;
+		}
+		comp = vec_push(&tok->comps, NULL);
+		comp->off = (uint32_t)(pos - path);
+		comp->len = (uint32_t)len;
 	}
 
 #ifdef DEBUG
-	printf("path_calc_target:%d ", __LINE__);
-	str_examine(path);
+	printf("end path_calc_target:%d ---------------\n", __LINE__);
+	path_target_dump(tok);
 #endif
+}
 
-	/* path now contains full, possibly ugly path */
+extern mnttab_t *MNTIDX; /* mount points */
+extern lnkcache_t *LNKCACHE; /* symlinks already read */
+extern bstat_t *PREFSTAT; /* lstat()s ahead of the walk */
+extern statcache_t *STATCACHE; /* lstat()s earlier walks did */
 
-	list = list_head_create();
+/* path_split() walks one component at a time relative to an open fd for the */
+/* parent directory, so each level costs the kernel one lookup instead of a */
+/* re-walk of the whole abspath. if we can't hold the parent open we fall */
+/* back to the abspath for that component */
+#ifndef O_PATH
+#define O_PATH O_RDONLY /* needs read perms on the dir, we fall back if denied */
+#endif
 
-	pos1 = path; /* beginning of path */
-	pos2 = pos1 + 1; /* right after first / */
-	end = strchr(path, '\0'); /* end of path */
+#define WALK_NOFD (-1) /* no parent fd held, use abspath */
 
-	do {
-		int tmplen;
-		/* end decl */
-		tmplen = pos2 - pos1;
-		tmp = strndup(pos1, pos2 - pos1);
-#ifdef DEBUG
-		printf("path_calc_target:%d path: \"%s\", tmp: \"%s\", pos1: \"%s\", pos2: \"%s\", tmplen: %d\n",
-			__LINE__, path, tmp, pos1, pos2, tmplen);
-#endif
-		if (0 == strcmp(tmp, "..")) { /* going back one */
-#ifdef DEBUG
-			printf("going back (..)\n");
-#endif
-			if (list_size(list) == 0) /* if we rewind past the beginning *f the path, bail! */
-				fatal_invalid_path(__FILE__, __LINE__, path, 0);
-			list_remove(list, list_last(list), NULL); /* remove the last entry to the list */
-		} else if (0 != strcmp(tmp, ".")) {
-			/* if we're not talking about current dir ".", then add the entry */
-#ifdef DEBUG
-	printf("path_calc_target:%d ", __LINE__);
-	str_examine(tmp);
-#endif
-			len += tmplen + 1; /* remember total length of path */
-			node = list_node_create(tmp, tmplen + 1);
-			list_append(list, node);
-#ifdef DEBUG
-		} else {
-			printf("same dir (.)\n");
-#endif
-		}
+/* rawpath[from..from+n) are lstat()ed, in PREFSTAT ents from 0 */
+typedef struct {
+	size_t from, n;
+} walkahead_t;
 
-		/* special case for first iteration */
-		pos1 = pos2 + ((pos1 > path) ? 1 : 0);
-		
-		xfree(tmp);
+#define walkahead_has(ahead, i)	((i) >= (ahead)->from && (i) < (ahead)->from + (ahead)->n)
 
-		if (NULL == (pos1 = strnchr(pos1, PATHSEP))) /* find the first non-sep char */
-			break;
-		if (NULL == (pos2 = strchr(pos1, PATHSEP))) /* find up until the next sep char */
-			pos2 = end;
-	 } while (pos1 < end);
+static void walk_close(int);
+static int walk_lstat(int, const char *, const char *, struct stat *);
+static int walk_stat(const pathtok_t *, size_t, walkahead_t *, int, const char *, const char *, struct stat *, char *);
+static stroff_t walk_readlink(vec_t *, int, const char *, const char *, const struct stat *);
+static int walk_descend(int, const char *, const char *, const struct stat *);
+static stroff_t walk_join(vec_t *, stroff_t, int, const char *, size_t);
+static int walk_reopen(const char *);
+static void walk_retarget(pathtok_t *, size_t, const char *, const char *);
+static size_t walk_ahead(const pathtok_t *, size_t, const char *);
+
+static void walk_close(int dirfd)
+{
+	if (dirfd >= 0)
+		close(dirfd);
+}
 
-	xfree(path);
+/* lstat() a component relative to its parent */
+static int walk_lstat(int dirfd, const char *abspath, const char *component, struct stat *st)
+{
+	if (WALK_NOFD == dirfd)
+		return lstat(abspath, st);
+	return fstatat(dirfd, component, st, AT_SYMLINK_NOFOLLOW);
+}
 
-#ifdef DEBUG
-	printf("end path_calc_target:%d ---------------\n", __LINE__);
-	list_dump(list, list_dump_cb_chars);
-#endif
+/* lstat() component i of rawpath from wherever it's cheapest: ahead if */
+/* walk_ahead() got to it, STATCACHE, or the fs. a dir that comes back slow */
+/* sends what's after it out on PREFSTAT and ahead is moved on to that */
+/* cached is set if st came from STATCACHE and needn't go back in */
+/* returns 0, or -1 with errno set */
+static int walk_stat(const pathtok_t *rawpath, size_t i, walkahead_t *ahead, int dirfd, const char *abspath, const char *component, struct stat *st, char *cached)
+{
+	long long start;
+	int rc;
+	*cached = 0;
+	if (walkahead_has(ahead, i)) {
+		const bstat_ent_t *ent = &PREFSTAT->ents[i - ahead->from];
+		*st = ent->st;
+		errno = ent->err;
+		return (0 == ent->err ? 0 : -1);
+	}
+	if (NULL != STATCACHE && 0 == statcache_get(STATCACHE, abspath, st)) {
+		*cached = 1;
+		return 0;
+	}
+	start = bstat_nsec();
+	rc = walk_lstat(dirfd, abspath, component, st);
+	if (0 == rc && S_ISDIR(st->st_mode) && bstat_nsec() - start > BSTAT_SLOW_NSEC) {
+		ahead->from = i + 1;
+		ahead->n = walk_ahead(rawpath, i, abspath);
+	}
+	return rc;
+}
 
-	return list;
+/* readlink() a component relative to its parent, st is its lstat() */
+/* LNKCACHE has it if we've read it since it last changed */
+/* returns where the target went in strs, STROFF_NONE if it couldn't be read */
+static stroff_t walk_readlink(vec_t *strs, int dirfd, const char *abspath, const char *component, const struct stat *st)
+{
+	const char *target;
+	char *buf = NULL;
+	stroff_t off;
+	if (NULL == LNKCACHE || NULL == (target = lnkcache_get(LNKCACHE, st))) {
+		if (WALK_NOFD == dirfd)
+			buf = readlinkat_malloc(AT_FDCWD, abspath, (size_t)st->st_size);
+		else
+			buf = readlinkat_malloc(dirfd, component, (size_t)st->st_size);
+		if (NULL == buf)
+			return STROFF_NONE;
+		target = (NULL == LNKCACHE ? buf : lnkcache_put(LNKCACHE, st, buf));
+	}
+	off = strtab_add(strs, target, strlen(target));
+	xfree(buf);
+	return off;
+}
 
+/* step into a component if it's a directory, releasing its parent */
+/* returns the fd to walk the next component from */
+static int walk_descend(int dirfd, const char *abspath, const char *component, const struct stat *st)
+{
+	int fd = WALK_NOFD;
+	if (S_ISDIR(st->st_mode)) {
+		if (WALK_NOFD == dirfd)
+			fd = open(abspath, O_PATH | O_DIRECTORY | O_NOFOLLOW);
+		else
+			fd = openat(dirfd, component, O_PATH | O_DIRECTORY | O_NOFOLLOW);
+		if (-1 == fd)
+			fd = WALK_NOFD;
+	}
+	/* anything under a non-dir gets ENOTDIR from the abspath lstat() */
+	walk_close(dirfd);
+	return fd;
 }
 
-extern list_head *MNTPTS; /* mount points */
+/* pick the walk back up at a dir we've already been through */
+/* every component of abspath has been lstat()ed and isn't a symlink */
+static int walk_reopen(const char *abspath)
+{
+	int fd = open(abspath, O_PATH | O_DIRECTORY | O_NOFOLLOW);
+	return (-1 == fd ? WALK_NOFD : fd);
+}
+
+/* the symlink at component i of rawpath points at target, relative to dir */
+/* replace rawpath with where that leads: target, then whatever came after i */
+static void walk_retarget(pathtok_t *rawpath, size_t i, const char *target, const char *dir)
+{
+	VEC_SMALL(char, PATHTOK_INLINE) joined;
+	size_t j;
+	vec_init_small(&joined, char);
+	(void)strtab_add(&joined.vec, target, strlen(target));
+	for (j = i + 1; j < pathtok_len(rawpath); j++) {
+		vec_last(&joined.vec, char)[0] = PATHSEP; /* over the '\0' */
+		(void)strtab_add(&joined.vec, pathtok_str(rawpath, j), pathtok_strlen(rawpath, j));
+	}
+	path_calc_target(rawpath, vec_first(&joined.vec, char), dir);
+	vec_destroy(&joined.vec);
+}
+
+/*
+	on nfs and the like every lstat() of the walk is a round trip, but the
+	rest of the path is known up front. once one lstat() comes back slow,
+	everything past it goes out at once on PREFSTAT's ring and the walk
+	takes the answers in order instead. each one only stands as long as
+	everything before it turned out a plain dir, the walk checks that as it
+	goes. a symlink changes the rest of the path, the answers past it are
+	dropped and the walk goes back to one at a time until the next slow one
+*/
+
+/* abspath is rawpath up to component i, lstat() up to BSTAT_BATCH of the */
+/* components after it all at once, they land in PREFSTAT ents in order */
+/* returns how many, 0 if they can't be done faster than one at a time */
+static size_t walk_ahead(const pathtok_t *rawpath, size_t i, const char *abspath)
+{
+	VEC_SMALL(char, PATHTOK_INLINE * 4) strs;
+	stroff_t offs[BSTAT_BATCH];
+	const char *ahead[BSTAT_BATCH];
+	stroff_t prev;
+	size_t n, j;
+
+	if (NULL == PREFSTAT)
+		return 0;
+	vec_init_small(&strs, char);
+	prev = strtab_add(&strs.vec, abspath, strlen(abspath));
+	for (n = 0; n < BSTAT_BATCH && i + 1 + n < pathtok_len(rawpath); n++) /* no PATHSEP after "/" */
+		prev = offs[n] = walk_join(&strs.vec, prev, i + n > 0,
+			pathtok_str(rawpath, i + 1 + n), pathtok_strlen(rawpath, i + 1 + n));
+	for (j = 0; j < n; j++)
+		ahead[j] = strtab_at(&strs.vec, offs[j]);
+	if (0 != n && -1 == bstat_paths(PREFSTAT, ahead, n))
+		n = 0;
+	vec_destroy(&strs.vec);
+	return n;
+}
+
+/* prefix, then a PATHSEP if sep, then component of clen chars, as one string in strs */
+static stroff_t walk_join(vec_t *strs, stroff_t prefix, int sep, const char *component, size_t clen)
+{
+	size_t plen;
+	stroff_t off;
+	char *p;
+	if (STROFF_NONE == prefix) {
+		plen = 0;
+		off = strtab_add(strs, "", 0);
+	} else {
+		plen = strlen(strtab_at(strs, prefix));
+		off = strtab_add(strs, strtab_at(strs, prefix), plen);
+	}
+	vec_reserve(strs, vec_len(strs) + (sep ? 1 : 0) + clen);
+	p = strtab_at(strs, off) + plen;
+	if (sep)
+		*p++ = PATHSEP;
+	memcpy(p, component, clen);
+	p[clen] = '\0';
+	vec_truncate(strs, (p - strtab_at(strs, 0)) + clen + 1);
+	return off;
+}
 
 /* get cwd, split into list */
 /* most of the path logic is here */
-/* FIXME: this function is too long, needs to be broken up */
-list_head *path_split(list_head **rawpath, int follow_symlinks)
+/* pushes a path_t onto paths for every symlink followed, then one for each */
+/* component of where we ended up, their names go in paths' string table */
+/* returns 0, or -1 with errno set if some component could not be lstat()ed, */
+/* or was a symlink that had gone by the time we read it, */
+/* paths then ends with that component, marked STATUS_UNKNOWN */
+int path_split(pathvec_t *paths, pathtok_t *rawpath, int follow_symlinks)
 {
-	list_head *paths = NULL, *links = NULL;
-	list_node *loopnode = NULL, *node = NULL;
-	path_t *path = NULL, *prevpath = NULL;
+	/* components resolved since the last symlink, their names go straight into paths */
+	VEC_SMALL(path_t, PATHVEC_INLINE) walked;
+	VEC_SMALL(pathname_t, PATHVEC_INLINE) walked_names;
+	path_t work, *path = &work;
+	pathname_t name;
+	stroff_t prevabs = STROFF_NONE; /* abspath of the component before this one */
+	const char *comp, *abspath;
 	char bail = 0; /* loop bail flag */
 	int symcnt = 0; /* symlink depth counter */
+	int dirfd = AT_FDCWD; /* parent of the current component, "/" is absolute */
+	mntcur_t mntcur; /* mount the components so far are on */
+	size_t i; /* component of rawpath we're on */
+	size_t compl; /* its length */
+	walkahead_t ahead = { 0, 0 }; /* what walk_ahead() has lstat()ed */
 	short c = 0; /* loop counter */
 
 #ifdef DEBUG
+	assert(NULL != paths);
 	assert(NULL != rawpath);
 	printf("path_split:%d ---------------\n", __LINE__);
-	list_dump(*rawpath, list_dump_cb_chars);
+	path_target_dump(rawpath);
 #endif
 
-	/* allocate paths */
-	if (NULL == (paths = list_head_create()))
-		err_bail(__FILE__, __LINE__, "couldn't create list");
-
-	/* allocate links */
-	if (NULL == (links = list_head_create()))
-		err_bail(__FILE__, __LINE__, "couldn't create list");
+	/* symlinks go straight onto paths, we need to hold the rest separately */
+	/* because a symlink cuts it back to what it shares with the target */
+	vec_init_small(&walked, path_t);
+	vec_init_small(&walked_names, pathname_t);
 
-	/* allocate path_t, we keep this the whole way through */
-	path = path_alloc();
+	if (NULL != STATCACHE) /* catch up on what's changed since the last walk */
+		statcache_sync(STATCACHE);
 
 	/* for each part of the path */
 	for (
-		loopnode = list_first(*rawpath);
-		bail == 0 && loopnode != NULL;
+		i = 0;
+		bail == 0 && i < pathtok_len(rawpath);
 		c++
 	) {
-#if 0
-#if 0
-		printf("path_split%d LOOP loopnode:%p, prevpath:%p\n",
-			__LINE__, (void *)loopnode, (void *)prevpath);
-		list_node_dump(loopnode, list_dump_cb_chars);
-#endif
-#endif
-
-
-#ifdef DEBUG
-		printf("%%%%%%%%%%%%%%%% path_alloc(%p):%d\n", path, __LINE__);
-#endif
+		comp = pathtok_str(rawpath, i);
 
 		path_init(path);
+		name.symlink = STROFF_NONE;
 
-#ifdef DEBUG
-		printf("path_split:%d: ", __LINE__);
-		path_dump(path);
-#endif
 		/* construct abspath to this point */
-		if (NULL != prevpath) {
-#ifdef DEBUG
-#if 0
-			printf("path_split:%d prevpath->abspath: \"%s\"\n",
-				__LINE__, prevpath->abspath);
-			path_dump(prevpath);
-#endif
-#endif
-			path->dir = strdup(prevpath->abspath);
-			path->abspath = strdup(prevpath->abspath);
-#ifdef DEBUG
-			printf("path_split:%d c:%d, ", __LINE__, c);
-			str_examine(prevpath->abspath);
-#endif
-		}
-		if (c >= 2) {
-			/* only throw PATHSEP in after second... ("/", "path", *HERE* "path2"... ) */
-#ifdef DEBUG
-			printf("path_split:%d path: ", __LINE__);
-			path_dump(path);
-#endif
-			path->abspath = strcapp(path->abspath, PATHSEP);
-		}
+		/* only throw PATHSEP in after second... ("/", "path", *HERE* "path2"... ) */
+		compl = pathtok_strlen(rawpath, i);
+		name.abspath = walk_join(&paths->strs, prevabs, c >= 2, comp, compl); /* append current path */
+		/* add component, which is just the tail of abspath */
+		name.component = name.abspath + (stroff_t)(strlen(pathvec_at(paths, name.abspath)) - compl);
+		abspath = pathvec_at(paths, name.abspath); /* good until we add a string */
 #ifdef DEBUG
 		printf("path_split:%d c:%d, ", __LINE__, c);
-		str_examine(path->abspath);
-#endif
-		path->abspath = strapp(path->abspath, loopnode->data); /* append current path */
-#if 0
-#if 0
-		printf("%s:%d:prevpath(%p), path->abspath:%s, loopnode->data(%p) \"%s\"\n",
-			__FILE__, __LINE__, (void *)prevpath, path->abspath,
-			(void *)loopnode->data, (char *)loopnode->data);
-		path_dump(path);
+		str_examine(abspath);
 #endif
-#endif
-		/* add component */
-		if (NULL == (path->component = strdup(loopnode->data)))
-			err_bail(__FILE__, __LINE__, "could not dupe loopnode->data");
 
 		{ /* new block */
 			struct stat st;
-			char is_lnk;
+			char is_lnk, cached;
+			int rc;
 			/* end decl */
 			is_lnk = 0;
 			errno = 0; /* reset errno */
-			/* get file stats */
-#ifdef DEBUG
-#if 0
-			printf("path_split:%d\n", __LINE__);
-			path_dump(path);
-#endif
-#endif
-			if (-1 == lstat(path->abspath, &st)) { /* error reading file */ 
+			/* get file stats, walk_ahead() or an earlier walk may have them already */
+			rc = walk_stat(rawpath, i, &ahead, dirfd, abspath, pathvec_at(paths, name.component), &st, &cached);
+			/* a symlink can be swapped out between the lstat() and the readlink(), */
+			/* that's a bad path for this caller, not a reason to take everyone down */
+			if (0 == rc && FOLLOW == follow_symlinks && S_ISLNK(st.st_mode)
+					&& STROFF_NONE == (name.symlink = walk_readlink(&paths->strs, dirfd, abspath,
+						pathvec_at(paths, name.component), &st)))
+				rc = -1;
+			abspath = pathvec_at(paths, name.abspath); /* the target may have moved strs */
+			if (0 == rc && !cached && NULL != STATCACHE)
+				statcache_put(STATCACHE, abspath, pathvec_str(paths, prevabs), &st);
+			if (-1 == rc) { /* error reading file */ 
 				int save_err = errno;
 #ifdef DEBUG
-				str_examine(path->abspath);
+				str_examine(abspath);
 				fprintf(stderr, "%s\n", strerror(save_err));
 #endif
-				/* FIXME: should i bail immediately? */
-				fatal_invalid_path(__FILE__, __LINE__, path->abspath, save_err);
-				break;
+				/* let the caller decide whether this is fatal, and leave it */
+				/* what we got through and what stopped us, --watch wants to */
+				/* know when the missing piece turns up */
+				walk_close(dirfd);
+				path->status = STATUS_UNKNOWN;
+				vec_push(&walked.vec, path);
+				vec_push(&walked_names.vec, &name);
+				vec_append(&paths->paths, &walked.vec);
+				vec_append(&paths->names, &walked_names.vec);
+				vec_destroy(&walked.vec);
+				vec_destroy(&walked_names.vec);
+				errno = save_err;
+				return -1;
 			}
 			/* file exists and is accessible */
 			/* is abspath a symlink? */
 			if (FOLLOW == follow_symlinks && S_ISLNK(st.st_mode)) {
 				/* figure out where the symlink points */
-				if (NULL == (path->symlink = readlink_malloc(path->abspath)))
-					err_bail(__FILE__, __LINE__, "could not resolve symlink");
+				const char *target;
+				target = pathvec_at(paths, name.symlink); /* good until we add a string */
+				path->flags |= PATH_SYMLINK;
 				/* if symlinks too deep, make a note (we'll report later) and bail */
 				if (++symcnt > MAXSYMLINKS) {
-					list_nodes_free(paths, path_free); /* nuke where we are */
+					vec_clear(&walked.vec); /* nuke where we are */
+					vec_clear(&walked_names.vec);
 					/* mark last symlink we saw as an error */
 					path->status = STATUS_SYMLINKS_TOO_DEEP;
-					bail = 1; /* need to add node and leave loop */
+					bail = 1; /* need to add path and leave loop */
 				}
-				if (0 == bail) { /* follow symlink, reset everything */
-#ifdef DEBUG
-#if 1
-					printf("path_split:%d following symlink from \"%s\" to \"%s\", resetting...\n",
-						__LINE__, path->abspath, path->symlink);
-					list_dump(paths, path_dump);
-#endif
-#endif
-					list_nodes_free(paths, path_free); /* clear current */
-#ifdef DEBUG
-#if 0
-					printf("path_split%d: *rawpath: ", __LINE__);
-					list_dump(*rawpath, list_dump_cb_chars);
-					printf("path_split%d: path (check dir): ", __LINE__);
-					path_dump(path);
-#endif
-#endif
-					list_free(*rawpath, NULL); /* destroy rawpath */
-					*rawpath = path_calc_target(path->symlink, path->dir); /* recalc path from symlink */
-					loopnode = list_first(*rawpath); /* reset loop */
-#ifdef DEBUG
-					printf("path_split:%d everything reset, continuing...\n", __LINE__);
-					list_dump(*rawpath, list_dump_cb_chars);
-#endif
-					prevpath = NULL;
-					c = -1; /* gets incremented next loop back to zero */
+				if (0 == bail) { /* follow symlink, keep what's already walked that the target shares */
+#ifdef DEBUG
+					printf("path_split:%d following symlink from \"%s\" to \"%s\"...\n",
+						__LINE__, pathvec_str(paths, name.abspath), target);
+#endif
+					/* recalc path from symlink, relative to the dir it's in, plus what was after it */
+					walk_retarget(rawpath, i, target, pathvec_str(paths, prevabs));
+					ahead.n = 0; /* lstat()ed through the link, not past it */
+					for (i = 0; i < vec_len(&walked_names.vec) && i < pathtok_len(rawpath); i++)
+						if (0 != strcmp(pathvec_at(paths, vec_at(&walked_names.vec, pathname_t, i).component),
+							pathtok_str(rawpath, i)))
+							break;
+					vec_truncate(&walked.vec, i);
+					vec_truncate(&walked_names.vec, i);
+#ifdef DEBUG
+					printf("path_split:%d %d components kept, continuing...\n", __LINE__, (int)i);
+					path_target_dump(rawpath);
+#endif
+					walk_close(dirfd);
+					if (0 == i) { /* start walking from "/" again */
+						prevabs = STROFF_NONE;
+						dirfd = AT_FDCWD;
+					} else {
+						prevabs = vec_last(&walked_names.vec, pathname_t)->abspath;
+						dirfd = walk_reopen(pathvec_at(paths, prevabs));
+						if (NULL != MNTIDX) /* catch the mount trie up, no syscalls */
+							for (c = 0; c < (short)i; c++)
+								mnttab_step(MNTIDX, &mntcur, pathtok_str(rawpath, c), pathtok_strlen(rawpath, c));
+					}
+					c = (short)i - 1; /* gets incremented next loop */
 					is_lnk = 1;
-#ifdef DEBUG
-					printf("path_split:%d path after ln: ", __LINE__);
-					path_dump(path);
-#endif
 				}
 			} else { /* dir or file */
 				/* copy data about the file to our own structure */
 				path->mode = st.st_mode;
 				path->uid = st.st_uid;
 				path->gid = st.st_gid;
-				/* resolve mntpt, if any */
-#ifdef DEBUG
-#if 0
-				printf("&&&&&&&&&& path_split:%d mnts(%p), path->abspath(%p): \"%s\"\n",
-					__LINE__, (void *)mnts, (void *)path->abspath, path->abspath);
-#endif
-#endif
-				/* if we're not a mntpt... */
-				if (NULL == (path->mntpt = mnt_mntdir_find(MNTPTS, path->abspath))) {
-#ifdef DEBUG
-#if 0
-					if (NULL == prevpath)
-						err_bail(__FILE__, __LINE__,
-							"either this is / and unmounted or prevpath is pointing to the wrong place");
-#endif
-#endif
-					/* point to prev mntpt, which is the mntpt we need to respect */
-					if (NULL != prevpath)
-						path->mntpt = prevpath->mntpt;
+				/* resolve mntpt, the walk down the mount trie keeps pace with ours */
+				/* and restarts with it, since the first component is always "/" */
+				if (NULL != MNTIDX) {
+					mnttab_step(MNTIDX, &mntcur, pathvec_at(paths, name.component), compl);
+					path->mntpt = mntcur.mnt;
+					if (NULL != path->mntpt && 0 == strcmp(abspath, path->mntpt->mntdir))
+						path->flags |= PATH_MNTPT;
+				}
+				/* next component is looked up relative to this one, unless */
+				/* walk_ahead() already did it by abspath, or we didn't need to */
+				/* look this one up and have no fd for it */
+				if (cached || walkahead_has(&ahead, i + 1)) {
+					walk_close(dirfd);
+					dirfd = WALK_NOFD;
+				} else {
+					dirfd = walk_descend(dirfd, abspath, pathvec_at(paths, name.component), &st);
 				}
 			}
-#ifdef DEBUG
-#if 0
-			printf("******** path_split%d: path:", __LINE__);
-			path_dump(path);
-			printf("path_split:%d is_lnk: %d\n", __LINE__, (int)is_lnk);
-#endif
-#endif
-			/* copy path_entry into node, append to paths */
-
-			node = list_node_create_deep(path, path_dupe);
-			/* if symlink, append to links, we need to hold our symlinks separately because
-			paths gets completely reset every time, but we still want to report symlinks */
-			if (NULL == (node = list_append((is_lnk ? links : paths), node)))
-				err_bail(__FILE__, __LINE__, "could not append path_entry to paths!");
-
-			/* point to node as long as it's related to current path */
-			if (!is_lnk) {
-				prevpath = node->data;
-				loopnode = list_node_next(loopnode);
+
+			if (is_lnk) {
+				pathvec_push(paths, path, &name);
+			} else {
+				vec_push(&walked.vec, path);
+				vec_push(&walked_names.vec, &name);
+				prevabs = name.abspath;
+				i++;
 			}
 
 #ifdef DEBUG
-		printf("path_split:%d c: %d, *rawpath: ", __LINE__, c);
-		list_dump(*rawpath, list_dump_cb_chars);
-#if 0
-			printf("^^^^^^^^^^ after list_append: ");
-			printf("links: ");
-			list_dump(links, path_dump);
-			printf("paths: ");
-			list_dump(paths, path_dump);
-			printf("^^^^^^^^^^^^^^^^\n");
+		printf("path_split:%d c: %d, rawpath: ", __LINE__, c);
+		path_target_dump(rawpath);
 #endif
-#endif
-
-
 		}
 	}
 
 #ifdef DEBUG
-	printf("path_split loop over! why? bail:%d, loopnode:%p\n",
-		(int)bail, (void *)loopnode);
+	printf("path_split loop over! why? bail:%d, i:%d\n",
+		(int)bail, (int)i);
 #endif
 
-	path_free(path);
-
-#ifdef DEBUG
-#if 0
-	printf("######### path_split:%d pre-concat links and paths: ", __LINE__);
-	list_dump(links, path_dump);
-	list_dump(paths, path_dump);
-#endif
-#endif
+	walk_close(dirfd);
 
-	/* append paths onto links */
-	list_concat(links, paths);
+	/* append where we ended up onto the symlinks that got us there */
+	vec_append(&paths->paths, &walked.vec);
+	vec_append(&paths->names, &walked_names.vec);
+	vec_destroy(&walked.vec);
+	vec_destroy(&walked_names.vec);
 
 #ifdef DEBUG
-#if 1
 	printf("######### path_split:%d post-concat links and paths: ", __LINE__);
-	list_dump(links, path_dump);
-#if 0
-	 list_dump(paths, path_dump);
-#endif
-#endif
+	pathvec_dump(paths);
 #endif
 
-	list_head_free(paths); /* no longer need second list_head */
+	return 0;
+
+}
+
+/* fill in abspath for paths[i] from its component and the entries before it */
+/* entries found while scanning a directory only get an abspath when someone needs it */
+/* returns it, good until the next string goes into paths */
+const char *path_chain_abspath(pathvec_t *paths, size_t i)
+{
+	pathname_t *name;
+	const char *comp;
+	stroff_t dir;
+	size_t dirlen, complen;
+	char *p;
 
 #ifdef DEBUG
-#if 0
-	printf("end path_split:%d c: %d, *rawpath: ", __LINE__, c);
-	list_dump(*rawpath, list_dump_cb_chars);
-#endif
+	assert(NULL != paths);
+	assert(i < pathvec_len(paths));
 #endif
 
-	return links;
+	name = pathvec_name(paths, i);
+	if (STROFF_NONE != name->abspath)
+		return pathvec_str(paths, name->abspath);
 
-}
+	if (0 == i)
+		err_bail(__FILE__, __LINE__, "path has neither abspath nor parent");
 
+	path_chain_abspath(paths, i - 1);
+	dir = pathvec_name(paths, i - 1)->abspath;
+	dirlen = strlen(pathvec_at(paths, dir));
+	complen = strlen(pathvec_at(paths, name->component));
 
+	/* dir, a PATHSEP unless dir is "/", then the component */
+	name->abspath = strtab_add(&paths->strs, pathvec_at(paths, dir), dirlen);
+	vec_reserve(&paths->strs, vec_len(&paths->strs) + 1 + complen);
+	p = pathvec_at(paths, name->abspath) + dirlen;
+	if (0 == dirlen || PATHSEP != p[-1]) /* "/" already ends in a sep */
+		*p++ = PATHSEP;
+	comp = pathvec_at(paths, name->component);
+	memmove(p, comp, complen + 1);
+	vec_truncate(&paths->strs, (p - pathvec_at(paths, 0)) + complen + 1);
+
+	return pathvec_at(paths, name->abspath);
+}
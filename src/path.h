@@ -8,11 +8,26 @@
 /* path functions */
 path_t * path_alloc(void);
 void path_init(path_t *);
-void *path_dupe(const void *);
 void path_free(void *);
 void path_dump(const void *);
-list_head *path_calc_target(const char *, const char *);
-list_head *path_split(list_head **, int);
+void path_calc_target(pathtok_t *, const char *, const char *);
+void path_target_dump(const pathtok_t *);
+int path_split(pathvec_t *, pathtok_t *, int);
+const char *path_chain_abspath(pathvec_t *, size_t);
+
+/* pathtok_t functions */
+void pathtok_init(pathtok_t *);
+void pathtok_destroy(pathtok_t *);
+
+/* pathvec_t functions */
+void pathvec_init(pathvec_t *);
+void pathvec_init_small(pathvec_small_t *);
+void pathvec_destroy(pathvec_t *);
+path_t *pathvec_push(pathvec_t *, const path_t *, const pathname_t *);
+path_t *pathvec_copy(pathvec_t *, const pathvec_t *, size_t);
+void pathvec_release(pathvec_t *, size_t);
+void pathvec_dump(const pathvec_t *);
+#define pathvec_pop(pv)	(vec_pop(&(pv)->paths), vec_pop(&(pv)->names))
 
 #endif
 
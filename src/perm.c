@@ -145,3 +145,43 @@ void permdsc_free(void *v)
 	permdsc_init(p);
 	xfree(p);
 }
+
+/*
+	PERM_ACCESS[rel << 9 | mode & 0777] is the REAS_YES_* reasons a user
+	standing in relation rel (PERM_REL_*) to a file with perm bits mode
+	gets read, write and exec by, 0 for each one not granted. every entry
+	is worked out by the compiler, see perm_access().
+
+	each of read, write and exec goes to the first of these that applies:
+	owner with the owner bit (root counts as owner, but for exec needs some
+	x bit on), group member with the group bit, then anybody with the other
+	bit.
+*/
+#define ACC_OWN(rel)		((rel) & PERM_REL_OWNER)
+#define ACC_GRP(rel)		((rel) & PERM_REL_GROUP)
+#define ACC_ROOT(rel)		((rel) & PERM_REL_ROOT)
+#define ACC_READ(m, rel) \
+	((ACC_ROOT(rel) || (((m) & S_IRUSR) && ACC_OWN(rel))) ? REAS_YES_UR : \
+	(((m) & S_IRGRP) && ACC_GRP(rel)) ? REAS_YES_GR : \
+	((m) & S_IROTH) ? REAS_YES_OR : 0)
+#define ACC_WRIT(m, rel) \
+	((ACC_ROOT(rel) || (((m) & S_IWUSR) && ACC_OWN(rel))) ? REAS_YES_UW : \
+	(((m) & S_IWGRP) && ACC_GRP(rel)) ? REAS_YES_GW : \
+	((m) & S_IWOTH) ? REAS_YES_OW : 0)
+#define ACC_EXEC(m, rel) \
+	(((ACC_ROOT(rel) && ((m) & (S_IXUSR | S_IXGRP | S_IXOTH))) || (((m) & S_IXUSR) && ACC_OWN(rel))) ? REAS_YES_UX : \
+	(((m) & S_IXGRP) && ACC_GRP(rel)) ? REAS_YES_GX : \
+	((m) & S_IXOTH) ? REAS_YES_OX : 0)
+#define ACC(i)		(ACC_READ((i) & 0777, (i) >> 9) | ACC_WRIT((i) & 0777, (i) >> 9) | ACC_EXEC((i) & 0777, (i) >> 9))
+#define ACC8(i)		ACC(i), ACC((i) + 1), ACC((i) + 2), ACC((i) + 3), \
+					ACC((i) + 4), ACC((i) + 5), ACC((i) + 6), ACC((i) + 7)
+#define ACC64(i)	ACC8(i), ACC8((i) + 8), ACC8((i) + 16), ACC8((i) + 24), \
+					ACC8((i) + 32), ACC8((i) + 40), ACC8((i) + 48), ACC8((i) + 56)
+#define ACC512(i)	ACC64(i), ACC64((i) + 64), ACC64((i) + 128), ACC64((i) + 192), \
+					ACC64((i) + 256), ACC64((i) + 320), ACC64((i) + 384), ACC64((i) + 448)
+
+const unsigned short PERM_ACCESS[PERM_ACCESS_SIZE] = {
+	ACC512(0), ACC512(512), ACC512(1024), ACC512(1536),
+	ACC512(2048), ACC512(2560), ACC512(3072), ACC512(3584)
+};
+
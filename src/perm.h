@@ -15,5 +15,21 @@ void permdsc_set_desc(permdsc_t *, const char *);
 void permdsc_set_mask(permdsc_t * ,perm_t);
 void permdsc_free(void *);
 
+/* how a user stands to a file, or'ed together */
+#define PERM_REL_OWNER	1
+#define PERM_REL_GROUP	2 /* member of the file's group */
+#define PERM_REL_ROOT	4
+
+/* read, write and exec decisions, one per relation and set of perm bits */
+#define PERM_ACCESS_SIZE	(((PERM_REL_OWNER | PERM_REL_GROUP | PERM_REL_ROOT) + 1) << 9)
+extern const unsigned short PERM_ACCESS[];
+
+/* REAS_YES_* that a user with relation rel gets read, write and exec by */
+#define perm_access(mode, rel)	(PERM_ACCESS[((rel) << 9) | ((mode) & 0777)])
+/* the REAS_YES_* bits that can grant perms want, of PERM_READ, PERM_WRIT and PERM_EXEC */
+#define perm_yes_mask(want)		((want) * 0x111)
+/* which of PERM_READ, PERM_WRIT and PERM_EXEC the REAS_YES_* in yes grant */
+#define perm_granted(yes)		(((yes) | (yes) >> 4 | (yes) >> 8) & (PERM_READ | PERM_WRIT | PERM_EXEC))
+
 #endif
 
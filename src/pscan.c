@@ -0,0 +1,509 @@
+/* ex: set ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h> /* openat, fstatat, AT_* */
+#include <unistd.h> /* sysconf */
+#include <pthread.h>
+#include <sys/stat.h>
+#include "bstat.h"
+#include "dents.h"
+#include "mnt.h"
+#include "path.h"
+#include "pscan.h"
+#include "util.h"
+
+/*
+	directories under the one being deleted are independent of each other, so
+	they're spread over a pool of threads. each thread owns a deque of pending
+	dirs: it pushes and pops its own at the bottom (depth-first, which keeps
+	few dirs open) and steals from the top of the others' when it runs dry.
+
+	the first entry that can't be deleted answers the question for the whole
+	tree, so it raises stop and every worker bails at its next entry. the
+	answer doesn't depend on which thread got there first, so neither does
+	the output. a dir or entry that couldn't be read raises stop too, with
+	unsure set, and the answer says we couldn't be certain like the serial
+	scan does.
+
+	a worker that finds every deque empty while others are still busy parks
+	on idle_cond. pushes bump gen and wake one parked worker, the last task
+	finishing or stop being raised wakes them all.
+*/
+
+extern mnttab_t *MNTIDX; /* mount points */
+
+/* an open directory whose children are being or waiting to be checked */
+typedef struct {
+	int fd;
+	int own; /* 0 for the caller's dir, we don't close that one */
+	int refs; /* the scan of this dir plus every pending child */
+	dev_t dev;
+} pscan_dir_t;
+
+/* a dir found by a scan, waiting to be judged and, if it passes, scanned */
+typedef struct {
+	pscan_dir_t *parent;
+	char *name;
+	char *abspath; /* only if the finder already built it */
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	dev_t dev;
+	mntpt_t *mntpt; /* mntpt of the parent, or of the entry if abspath is set */
+	perm_t reasmask; /* sticky mask down to the parent */
+} pscan_task_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pscan_task_t **tasks; /* pending tasks are tasks[head..tail) */
+	size_t head, tail, cap;
+} pscan_deque_t;
+
+typedef struct {
+	pscan_deque_t *deques;
+	int jobs;
+	int pending; /* tasks pushed but not finished */
+	int stop; /* set on the first entry we can't delete, see pscan_stop() */
+	int unsure; /* something couldn't be read, see pscan_unsure() */
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond;
+	unsigned gen; /* bumped on every push, so a parked worker knows to look again */
+	int idle; /* workers parked, or about to */
+	pscan_judge_t judge;
+	pscan_screen_t screen; /* NULL if every entry goes to judge */
+	void *ctx;
+} pscan_t;
+
+typedef struct {
+	pscan_t *scan;
+	int id;
+	bstat_t *stat; /* the thread's own, rings don't share */
+} pscan_worker_t;
+
+/* every worker polls stop between entries, the first to fail raises it */
+#define pscan_stopped(scan)	__atomic_load_n(&(scan)->stop, __ATOMIC_RELAXED)
+
+static void deque_init(pscan_deque_t *);
+static void deque_free(pscan_deque_t *);
+static void deque_push(pscan_deque_t *, pscan_task_t *);
+static pscan_task_t *deque_pop(pscan_deque_t *);
+static pscan_task_t *deque_steal(pscan_deque_t *);
+static void pscan_stop(pscan_t *);
+static void pscan_unsure(pscan_t *);
+static void pscan_wake(pscan_t *, int);
+static void pscan_park(pscan_t *, unsigned);
+static void pscan_dir_release(pscan_dir_t *);
+static void pscan_push(pscan_t *, int, pscan_dir_t *, const char *, const char *, const struct stat *, mntpt_t *, perm_t);
+static int pscan_judge(pscan_t *, pscan_dir_t *, path_t *, const char *, char *, dev_t, perm_t *);
+static void pscan_task(pscan_t *, int, bstat_t *, pscan_task_t *);
+static void *pscan_worker(void *);
+
+/****************************** deque functions *****************************/
+
+static void deque_init(pscan_deque_t *dq)
+{
+	pthread_mutex_init(&dq->lock, NULL);
+	dq->tasks = NULL;
+	dq->head = dq->tail = dq->cap = 0;
+}
+
+static void deque_free(pscan_deque_t *dq)
+{
+	pthread_mutex_destroy(&dq->lock);
+	xfree(dq->tasks);
+	dq->tasks = NULL;
+}
+
+/* owner adds to the bottom */
+static void deque_push(pscan_deque_t *dq, pscan_task_t *task)
+{
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail == dq->cap) {
+		if (dq->head > 0) { /* room at the top, slide down */
+			memmove(dq->tasks, dq->tasks + dq->head, (dq->tail - dq->head) * sizeof *dq->tasks);
+			dq->tail -= dq->head;
+			dq->head = 0;
+		} else {
+			dq->cap = (0 == dq->cap ? 64 : dq->cap * 2);
+			dq->tasks = xrealloc(dq->tasks, dq->cap * sizeof *dq->tasks);
+		}
+	}
+	dq->tasks[dq->tail++] = task;
+	pthread_mutex_unlock(&dq->lock);
+}
+
+/* owner takes from the bottom, newest first */
+static pscan_task_t *deque_pop(pscan_deque_t *dq)
+{
+	pscan_task_t *task = NULL;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail > dq->head)
+		task = dq->tasks[--dq->tail];
+	if (dq->tail == dq->head)
+		dq->head = dq->tail = 0;
+	pthread_mutex_unlock(&dq->lock);
+	return task;
+}
+
+/* thieves take from the top, oldest first, which tends to be the biggest subtree */
+static pscan_task_t *deque_steal(pscan_deque_t *dq)
+{
+	pscan_task_t *task = NULL;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail > dq->head)
+		task = dq->tasks[dq->head++];
+	pthread_mutex_unlock(&dq->lock);
+	return task;
+}
+
+/****************************** idle functions ******************************/
+
+/* wake one parked worker, or all of them */
+static void pscan_wake(pscan_t *scan, int all)
+{
+	/* pairs with pscan_park(): either we see it counted in idle, or it sees gen move */
+	__atomic_add_fetch(&scan->gen, 1, __ATOMIC_SEQ_CST);
+	if (0 == __atomic_load_n(&scan->idle, __ATOMIC_SEQ_CST))
+		return;
+	pthread_mutex_lock(&scan->idle_lock);
+	if (all)
+		pthread_cond_broadcast(&scan->idle_cond);
+	else
+		pthread_cond_signal(&scan->idle_cond);
+	pthread_mutex_unlock(&scan->idle_lock);
+}
+
+/* sleep until something is pushed after gen was seen, or nothing is pending */
+static void pscan_park(pscan_t *scan, unsigned seen)
+{
+	pthread_mutex_lock(&scan->idle_lock);
+	__atomic_add_fetch(&scan->idle, 1, __ATOMIC_SEQ_CST);
+	while (seen == __atomic_load_n(&scan->gen, __ATOMIC_SEQ_CST)
+			&& 0 < __atomic_load_n(&scan->pending, __ATOMIC_SEQ_CST))
+		pthread_cond_wait(&scan->idle_cond, &scan->idle_lock);
+	__atomic_sub_fetch(&scan->idle, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&scan->idle_lock);
+}
+
+/****************************** scan functions ******************************/
+
+/* answer the whole scan no, parked workers get up to drain what's queued */
+static void pscan_stop(pscan_t *scan)
+{
+	if (0 == __atomic_exchange_n(&scan->stop, 1, __ATOMIC_RELAXED))
+		pscan_wake(scan, 1);
+}
+
+/* answer no because we couldn't see everything, not because of what we saw */
+static void pscan_unsure(pscan_t *scan)
+{
+	__atomic_store_n(&scan->unsure, 1, __ATOMIC_RELAXED);
+	pscan_stop(scan);
+}
+
+static void pscan_dir_release(pscan_dir_t *dir)
+{
+	if (0 != __sync_sub_and_fetch(&dir->refs, 1))
+		return;
+	if (dir->own)
+		close(dir->fd);
+	xfree(dir);
+}
+
+/* queue a dir found in parent for worker id */
+/* abspath may be NULL, mntpt is the parent's unless abspath is given */
+static void pscan_push(pscan_t *scan, int id, pscan_dir_t *parent, const char *name,
+	const char *abspath, const struct stat *st, mntpt_t *mntpt, perm_t reasmask)
+{
+	pscan_task_t *task = xmalloc(sizeof *task);
+
+	if (NULL == (task->name = strdup(name)))
+		err_nomem(__FILE__, __LINE__, strlen(name) + 1);
+	task->abspath = NULL;
+	if (NULL != abspath && NULL == (task->abspath = strdup(abspath)))
+		err_nomem(__FILE__, __LINE__, strlen(abspath) + 1);
+	task->mode = st->st_mode;
+	task->uid = st->st_uid;
+	task->gid = st->st_gid;
+	task->dev = st->st_dev;
+	task->mntpt = mntpt;
+	task->reasmask = reasmask;
+	task->parent = parent;
+	__sync_add_and_fetch(&parent->refs, 1);
+
+	__sync_add_and_fetch(&scan->pending, 1);
+	deque_push(&scan->deques[id], task);
+	pscan_wake(scan, 0);
+}
+
+/* judge entry name of parent described by path, which inherits parent's mntpt */
+/* abspath is where it is if the finder knew, NULL if not, we free it */
+/* reasmask comes in as the parent's sticky mask and goes out as path's */
+static int pscan_judge(pscan_t *scan, pscan_dir_t *parent, path_t *path, const char *name, char *abspath, dev_t dev, perm_t *reasmask)
+{
+	int judged;
+
+	if (NULL == abspath && dev != parent->dev) { /* something is mounted here */
+		mntpt_t *mnt;
+		/* the kernel knows by mount ID, unless it's the parent's mount with */
+		/* a dev of its own (btrfs subvolumes) and we're not at its root */
+		if ((NULL != (mnt = mnttab_at(MNTIDX, parent->fd, name)) && mnt != path->mntpt)
+			|| NULL != (mnt = mnttab_dev(MNTIDX, dev))) {
+			/* crossing into a dev puts us on its root, which is where it's mounted */
+			if (NULL == (abspath = strdup(mnt->mntdir)))
+				err_nomem(__FILE__, __LINE__, strlen(mnt->mntdir) + 1);
+			path->mntpt = mnt;
+		} else { /* bind mount or unknown, ask the kernel where we are */
+			char link[32];
+			char *dir;
+			snprintf(link, sizeof link, "/proc/self/fd/%d", parent->fd);
+			if (NULL != (dir = readlink_malloc(link))) { /* otherwise we'll go with parent's */
+				if ('\0' == dir[0] || PATHSEP != dir[strlen(dir) - 1])
+					dir = strcapp(dir, PATHSEP);
+				abspath = strapp(dir, name);
+				if (NULL != (mnt = mnttab_find(MNTIDX, abspath)))
+					path->mntpt = mnt;
+			}
+		}
+	}
+	if (NULL != abspath && NULL != path->mntpt && 0 == strcmp(abspath, path->mntpt->mntdir))
+		path->flags |= PATH_MNTPT;
+
+	if (path_is_sticky(path))
+		*reasmask |= REAS_NO_STICKY;
+
+	judged = scan->judge(path, *reasmask, scan->ctx);
+
+	xfree(abspath);
+
+	return judged;
+}
+
+/* judge a dir and, if everything under it has to be checked, scan it */
+static void pscan_task(pscan_t *scan, int id, bstat_t *bst, pscan_task_t *task)
+{
+	pscan_dir_t *self;
+	path_t path;
+	struct stat st;
+	dents_t *dents;
+	bstat_ent_t *ent;
+	bjudge_mask_t look;
+	size_t n, i;
+	perm_t reasmask;
+	int fd, judged;
+
+	path_init(&path);
+	path.uid = task->uid;
+	path.gid = task->gid;
+	path.status = STATUS_OK;
+	path.mode = task->mode;
+	path.mntpt = task->mntpt;
+	reasmask = task->reasmask;
+
+	judged = pscan_judge(scan, task->parent, &path, task->name, task->abspath, task->dev, &reasmask);
+	task->abspath = NULL; /* pscan_judge() freed it */
+	switch (judged) {
+	case PSCAN_DESCEND:
+		break;
+	case PSCAN_FAIL:
+		pscan_stop(scan);
+		/* fall through */
+	default:
+		pscan_dir_release(task->parent);
+		return;
+	}
+
+	fd = openat(task->parent->fd, task->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	pscan_dir_release(task->parent);
+	if (-1 == fd) {
+		pscan_unsure(scan); /* can't be sure, so no */
+		return;
+	}
+	if (-1 == fstat(fd, &st) || NULL == (dents = dents_open(fd))) {
+		close(fd);
+		pscan_unsure(scan);
+		return;
+	}
+
+	self = xmalloc(sizeof *self);
+	self->fd = fd;
+	self->own = 1;
+	self->refs = 1;
+	self->dev = st.st_dev;
+
+	/* owner only matters under a sticky dir, so symlinks needn't be stat'ed outside one */
+	while (!pscan_stopped(scan) && 0 < (n = bstat_read(bst, dents, !(reasmask & REAS_NO_STICKY), self->dev))) {
+		look = (NULL == scan->screen ? BJUDGE_ALL(n) : scan->screen(bst, n, reasmask, self->dev, scan->ctx));
+		for (i = 0, ent = bst->ents; i < n && !pscan_stopped(scan); i++, ent++) {
+			perm_t entmask;
+
+			if (!(look & ((bjudge_mask_t)1 << i)))
+				continue;
+			if (0 != ent->err) {
+				if (ENOENT == ent->err)
+					continue; /* deleted under us, one less to worry about */
+				pscan_unsure(scan);
+				break;
+			}
+
+			if (S_ISDIR(ent->st.st_mode)) { /* judged when it's picked up */
+				pscan_push(scan, id, self, ent->name, NULL, &ent->st, path.mntpt, reasmask);
+				continue;
+			}
+
+			{ /* new block */
+				path_t ent_path = path;
+				ent_path.flags = 0;
+				ent_path.uid = ent->st.st_uid;
+				ent_path.gid = ent->st.st_gid;
+				ent_path.mode = ent->st.st_mode;
+				entmask = reasmask;
+				if (PSCAN_OK != pscan_judge(scan, self, &ent_path, ent->name, NULL, ent->st.st_dev, &entmask)) {
+					pscan_stop(scan);
+					break;
+				}
+			}
+		}
+	}
+
+	if (0 != dents->err)
+		pscan_unsure(scan); /* didn't see everything, can't be sure */
+	bstat_done(bst); /* stop may have left some of it in flight */
+	dents_close(dents); /* the fd lives on for queued children */
+	pscan_dir_release(self);
+}
+
+static void *pscan_worker(void *v)
+{
+	pscan_worker_t *w = v;
+	pscan_t *scan = w->scan;
+	pscan_task_t *task;
+	unsigned seen;
+	int i;
+
+	w->stat = bstat_alloc();
+	while (1) {
+		seen = __atomic_load_n(&scan->gen, __ATOMIC_SEQ_CST);
+		task = deque_pop(&scan->deques[w->id]);
+		for (i = 1; NULL == task && i < scan->jobs; i++)
+			task = deque_steal(&scan->deques[(w->id + i) % scan->jobs]);
+		if (NULL == task) {
+			if (0 == __sync_add_and_fetch(&scan->pending, 0))
+				break; /* nothing queued anywhere and nobody is adding */
+			pscan_park(scan, seen);
+			continue;
+		}
+		if (pscan_stopped(scan)) /* already answered, just drain */
+			pscan_dir_release(task->parent);
+		else
+			pscan_task(scan, w->id, w->stat, task);
+		xfree(task->abspath);
+		xfree(task->name);
+		xfree(task);
+		if (0 == __sync_sub_and_fetch(&scan->pending, 1))
+			pscan_wake(scan, 1); /* that was the last, everyone can go */
+	}
+
+	bstat_free(w->stat);
+	return NULL;
+}
+
+/* check that every dir in dirs, found in the open directory fd, could be deleted */
+/* along with everything under them, using jobs threads */
+/* dirs: path_t entries, stat'ed and given a mntpt but not yet judged */
+/* reasmask: sticky mask down to and including the directory fd */
+/* returns REAS_NONE if so, REAS_NO_DEPENDANCY if not, with REAS_NO_CERTAIN */
+/* if something under them couldn't be read */
+perm_t pscan_run(int fd, pathvec_t *dirs, perm_t reasmask, int jobs, pscan_judge_t judge, pscan_screen_t screen, void *ctx)
+{
+	pscan_t scan;
+	pscan_worker_t *workers;
+	pthread_t *threads;
+	pscan_dir_t *top;
+	path_t *path;
+	struct stat st;
+	size_t j;
+	int i, started;
+
+#ifdef DEBUG
+	assert(NULL != dirs);
+	assert(NULL != judge);
+#endif
+
+	if (jobs < 1)
+		jobs = 1;
+
+	if (-1 == fstat(fd, &st))
+		return REAS_NO_DEPENDANCY;
+
+	top = xmalloc(sizeof *top);
+	top->own = 0;
+	top->fd = fd;
+	top->refs = 1;
+	top->dev = st.st_dev;
+
+	scan.jobs = jobs;
+	scan.pending = 0;
+	scan.stop = 0;
+	scan.unsure = 0;
+	scan.gen = 0;
+	scan.idle = 0;
+	pthread_mutex_init(&scan.idle_lock, NULL);
+	pthread_cond_init(&scan.idle_cond, NULL);
+	scan.judge = judge;
+	scan.screen = screen;
+	scan.ctx = ctx;
+	scan.deques = xmalloc(jobs * sizeof *scan.deques);
+	for (i = 0; i < jobs; i++)
+		deque_init(&scan.deques[i]);
+
+	/* deal the dirs out round-robin */
+	for (j = 0; j < pathvec_len(dirs); j++) {
+		path = pathvec_path(dirs, j);
+		st.st_mode = path->mode;
+		st.st_uid = path->uid;
+		st.st_gid = path->gid;
+		st.st_dev = top->dev; /* mntpt is already resolved */
+		pscan_push(&scan, (int)(j % jobs), top, pathvec_component(dirs, j), pathvec_abspath(dirs, j),
+			&st, path->mntpt, reasmask);
+	}
+
+	workers = xmalloc(jobs * sizeof *workers);
+	threads = xmalloc(jobs * sizeof *threads);
+	for (i = 0; i < jobs; i++) {
+		workers[i].scan = &scan;
+		workers[i].id = i;
+	}
+
+	/* we're worker 0. if we can't get a thread, whoever we did get steals its share */
+	for (started = 1; started < jobs; started++)
+		if (0 != pthread_create(&threads[started], NULL, pscan_worker, &workers[started]))
+			break;
+	pscan_worker(&workers[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < jobs; i++)
+		deque_free(&scan.deques[i]);
+	xfree(scan.deques);
+	pthread_cond_destroy(&scan.idle_cond);
+	pthread_mutex_destroy(&scan.idle_lock);
+	xfree(workers);
+	xfree(threads);
+	pscan_dir_release(top);
+
+	if (!pscan_stopped(&scan))
+		return REAS_NONE;
+	return REAS_NO_DEPENDANCY | (__atomic_load_n(&scan.unsure, __ATOMIC_RELAXED) ? REAS_NO_CERTAIN : REAS_NONE);
+}
+
+/* how many threads to scan with if we're not told */
+int pscan_jobs_default(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n < 1 ? 1 : (int)n);
+}
+
@@ -0,0 +1,25 @@
+/* ex: set ts=4: */
+
+#ifndef PSCAN_H
+#define PSCAN_H
+
+#include "shac.h"
+#include "bjudge.h"
+
+/* what a judge callback says about one directory entry */
+#define PSCAN_OK		0	/* entry could be deleted */
+#define PSCAN_FAIL		1	/* entry could not be deleted */
+#define PSCAN_DESCEND	2	/* entry is a dir, could be deleted if everything under it can */
+
+/* judges path, reasmask carries the sticky mask down to and including path */
+typedef int (*pscan_judge_t)(path_t *, perm_t, void *);
+/* picks out the non-dir entries of a bstat_read() batch of a dir on dev */
+/* with sticky mask reasmask that the judge needs to see, the rest are PSCAN_OK */
+typedef bjudge_mask_t (*pscan_screen_t)(const bstat_t *, size_t, perm_t, dev_t, void *);
+
+/* parallel delete scanner */
+perm_t pscan_run(int, pathvec_t *, perm_t, int, pscan_judge_t, pscan_screen_t, void *);
+int pscan_jobs_default(void);
+
+#endif
+
@@ -0,0 +1,385 @@
+/* ex: set ts=4: */
+
+#define _GNU_SOURCE /* accept4 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#ifdef DEBUG
+#include <assert.h>
+#endif
+#include "serve.h"
+#include "vec.h"
+#include "util.h"
+
+#define SERVE_EVENTS	64 /* epoll events per wakeup */
+#define SERVE_READ		16384 /* bytes read off a client per wakeup, so nobody hogs the loop */
+#define SERVE_TURN		32 /* records answered per client per turn, then the next one gets a go */
+#define SERVE_RECORD	65536 /* longest record we'll wait for the end of */
+#define SERVE_BACKLOG	(1 << 20) /* answers a client can leave unread before we stop reading it */
+
+typedef struct serve_client serve_client_t;
+struct serve_client {
+	int fd;
+	vec_t in; /* chars read, up to a record we haven't seen the end of */
+	vec_t out; /* answers, out[outpos..) haven't been written yet */
+	size_t outpos;
+	int eof; /* client's done sending, hang up once out is written */
+	unsigned events; /* what epoll is watching for */
+	int queued; /* has whole records in in, waiting for its turn */
+	serve_client_t *prev, *next;
+	serve_client_t *rnext; /* next in line for a turn */
+};
+
+typedef struct {
+	int epfd;
+	int lfd; /* listening */
+	int full; /* out of fds, lfd is off the epoll until a client goes */
+	int delim; /* between records */
+	serve_answer_t answer;
+	void *ctx;
+	serve_client_t *clients;
+	serve_client_t *ready, *ready_tail; /* clients queued for a turn, in order */
+} serve_t;
+
+static volatile sig_atomic_t Serve_Stop = 0;
+
+static void serve_signal(int);
+static int serve_listen(const char *);
+static void serve_accept(serve_t *);
+static void serve_drop(serve_t *, serve_client_t *);
+static void serve_queue(serve_t *, serve_client_t *);
+static int serve_read(serve_t *, serve_client_t *);
+static int serve_answer(serve_t *, serve_client_t *);
+static int serve_write(serve_client_t *);
+static void serve_watch(serve_t *, serve_client_t *);
+static void serve_tend(serve_t *, serve_client_t *);
+static void serve_turns(serve_t *);
+
+static void serve_signal(int sig)
+{
+	Serve_Stop = 1;
+}
+
+/* a listening socket on sockpath, a stale one left by a dead server is replaced */
+static int serve_listen(const char *sockpath)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(sockpath) >= sizeof addr.sun_path)
+		fatal("socket path is too long");
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, sockpath);
+
+	if (-1 == (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)))
+		err_bail(__FILE__, __LINE__, "could not create socket");
+	if (-1 == bind(fd, (struct sockaddr *)&addr, sizeof addr)) {
+		struct stat st;
+		int probe;
+		if (EADDRINUSE != errno)
+			fatal("could not bind socket");
+		/* somebody answering on it is in use, nobody answering is left over */
+		if (-1 == (probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)))
+			err_bail(__FILE__, __LINE__, "could not create socket");
+		if (0 == connect(probe, (struct sockaddr *)&addr, sizeof addr) || ECONNREFUSED != errno
+			|| -1 == lstat(sockpath, &st) || !S_ISSOCK(st.st_mode))
+			fatal("socket path is already in use");
+		close(probe);
+		if (-1 == unlink(sockpath) || -1 == bind(fd, (struct sockaddr *)&addr, sizeof addr))
+			fatal("could not bind socket");
+	}
+	if (-1 == listen(fd, SOMAXCONN))
+		err_bail(__FILE__, __LINE__, "could not listen on socket");
+	return fd;
+}
+
+/* take every connection waiting on the listening socket */
+static void serve_accept(serve_t *srv)
+{
+	struct epoll_event ev;
+	serve_client_t *cl;
+	int fd;
+
+	while (-1 != (fd = accept4(srv->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC))) {
+		cl = xmalloc(sizeof *cl);
+		cl->fd = fd;
+		vec_init(&cl->in, 1, NULL, 0);
+		vec_init(&cl->out, 1, NULL, 0);
+		cl->outpos = 0;
+		cl->eof = 0;
+		cl->events = EPOLLIN;
+		cl->queued = 0;
+		cl->rnext = NULL;
+		cl->prev = NULL;
+		cl->next = srv->clients;
+		if (NULL != cl->next)
+			cl->next->prev = cl;
+		srv->clients = cl;
+		memset(&ev, 0, sizeof ev);
+		ev.events = cl->events;
+		ev.data.ptr = cl;
+		if (-1 == epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev))
+			err_bail(__FILE__, __LINE__, "could not watch client");
+	}
+	/* out of fds doesn't sort itself out, the connection would wake us */
+	/* again and again. stop listening until somebody hangs up */
+	if ((EMFILE == errno || ENFILE == errno) && NULL != srv->clients) {
+		epoll_ctl(srv->epfd, EPOLL_CTL_DEL, srv->lfd, NULL);
+		srv->full = 1;
+	}
+}
+
+static void serve_drop(serve_t *srv, serve_client_t *cl)
+{
+	struct epoll_event ev;
+
+	epoll_ctl(srv->epfd, EPOLL_CTL_DEL, cl->fd, NULL);
+	close(cl->fd);
+	if (cl->queued) { /* rare, it went wrong while it had records waiting */
+		serve_client_t **link, *r = NULL;
+		for (link = &srv->ready; *link != cl; link = &(*link)->rnext)
+			r = *link;
+		*link = cl->rnext;
+		if (srv->ready_tail == cl)
+			srv->ready_tail = r;
+	}
+	if (NULL != cl->prev)
+		cl->prev->next = cl->next;
+	else
+		srv->clients = cl->next;
+	if (NULL != cl->next)
+		cl->next->prev = cl->prev;
+	vec_destroy(&cl->in);
+	vec_destroy(&cl->out);
+	xfree(cl);
+
+	if (srv->full) { /* there's an fd free now */
+		memset(&ev, 0, sizeof ev);
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (-1 == epoll_ctl(srv->epfd, EPOLL_CTL_ADD, srv->lfd, &ev))
+			err_bail(__FILE__, __LINE__, "could not watch socket");
+		srv->full = 0;
+	}
+}
+
+/* put cl at the back of the line for a turn */
+static void serve_queue(serve_t *srv, serve_client_t *cl)
+{
+	cl->queued = 1;
+	cl->rnext = NULL;
+	if (NULL != srv->ready_tail)
+		srv->ready_tail->rnext = cl;
+	else
+		srv->ready = cl;
+	srv->ready_tail = cl;
+}
+
+/* read what cl has sent, queueing it for a turn if that ends a record */
+/* returns -1 if cl should be dropped */
+static int serve_read(serve_t *srv, serve_client_t *cl)
+{
+	size_t had = vec_len(&cl->in);
+	ssize_t got;
+
+	vec_reserve(&cl->in, vec_len(&cl->in) + SERVE_READ);
+	got = read(cl->fd, strtab_at(&cl->in, vec_len(&cl->in)), SERVE_READ);
+	if (-1 == got)
+		return (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno) ? 0 : -1;
+	if (0 == got) {
+		cl->eof = 1;
+		if (vec_len(&cl->in) > 0) /* last record, like the last line of --batch */
+			*(char *)vec_push(&cl->in, NULL) = (char)srv->delim;
+	}
+	vec_truncate(&cl->in, vec_len(&cl->in) + (size_t)got);
+
+	/* we don't read from a queued client, so what we had holds no record end */
+	if (NULL != memchr(strtab_at(&cl->in, had), srv->delim, vec_len(&cl->in) - had))
+		serve_queue(srv, cl);
+	else if (vec_len(&cl->in) > SERVE_RECORD)
+		return -1;
+	return 0;
+}
+
+/* answer up to SERVE_TURN of the whole records cl has sent */
+/* returns 1 if it has more waiting, 0 if not */
+static int serve_answer(serve_t *srv, serve_client_t *cl)
+{
+	char *rec, *end, *buf = NULL;
+	size_t len = 0, done;
+	int k;
+	FILE *out;
+
+	if (NULL == (out = open_memstream(&buf, &len)))
+		err_bail(__FILE__, __LINE__, "could not open answer buffer");
+	rec = strtab_at(&cl->in, 0);
+	for (done = 0, k = 0; k < SERVE_TURN && NULL != (end = memchr(rec, srv->delim, vec_len(&cl->in) - done));
+			k++, rec = end + 1) {
+		*end = '\0';
+		done += (size_t)(end - rec) + 1;
+		srv->answer(rec, out, srv->ctx);
+	}
+	if (0 != fclose(out))
+		err_bail(__FILE__, __LINE__, "could not close answer buffer");
+
+	vec_reserve(&cl->out, vec_len(&cl->out) + len);
+	memcpy(strtab_at(&cl->out, vec_len(&cl->out)), buf, len);
+	vec_truncate(&cl->out, vec_len(&cl->out) + len);
+	free(buf); /* open_memstream()'s, not ours */
+
+	/* keep what we haven't answered, and the part of a record we haven't seen the end of yet */
+	memmove(strtab_at(&cl->in, 0), rec, vec_len(&cl->in) - done);
+	vec_truncate(&cl->in, vec_len(&cl->in) - done);
+	return NULL != memchr(strtab_at(&cl->in, 0), srv->delim, vec_len(&cl->in));
+}
+
+/* write as much of cl's answers as it'll take, returns -1 if cl should be dropped */
+static int serve_write(serve_client_t *cl)
+{
+	ssize_t put;
+
+	while (cl->outpos < vec_len(&cl->out)) {
+		put = send(cl->fd, strtab_at(&cl->out, cl->outpos), vec_len(&cl->out) - cl->outpos, MSG_NOSIGNAL);
+		if (-1 == put) {
+			if (EINTR == errno)
+				continue;
+			return (EAGAIN == errno || EWOULDBLOCK == errno) ? 0 : -1;
+		}
+		cl->outpos += (size_t)put;
+	}
+	vec_clear(&cl->out);
+	cl->outpos = 0;
+	return 0;
+}
+
+/* watch cl for whatever it needs next: more records unless it's done, has */
+/* some waiting or is behind on reading its answers, room to write if */
+/* answers are waiting */
+static void serve_watch(serve_t *srv, serve_client_t *cl)
+{
+	struct epoll_event ev;
+	size_t backlog = vec_len(&cl->out) - cl->outpos;
+	unsigned events = 0;
+
+	if (!cl->eof && !cl->queued && backlog < SERVE_BACKLOG)
+		events |= EPOLLIN;
+	if (backlog > 0)
+		events |= EPOLLOUT;
+	if (events == cl->events)
+		return;
+	memset(&ev, 0, sizeof ev);
+	ev.events = events;
+	ev.data.ptr = cl;
+	if (-1 == epoll_ctl(srv->epfd, EPOLL_CTL_MOD, cl->fd, &ev))
+		err_bail(__FILE__, __LINE__, "could not watch client");
+	cl->events = events;
+}
+
+/* write what cl will take, then hang up on it or watch it for what's next */
+static void serve_tend(serve_t *srv, serve_client_t *cl)
+{
+	/* done once it has nothing left to say */
+	if (-1 == serve_write(cl) || (cl->eof && !cl->queued && vec_len(&cl->out) == cl->outpos)) {
+		serve_drop(srv, cl);
+		return;
+	}
+	serve_watch(srv, cl);
+}
+
+/* give every queued client a turn, those with records left go round again */
+/* after the next epoll_wait(), so nobody's backlog holds up the rest */
+static void serve_turns(serve_t *srv)
+{
+	serve_client_t *cl, *last = srv->ready_tail;
+	int end;
+
+	while (NULL != (cl = srv->ready)) {
+		end = (cl == last);
+		if (NULL == (srv->ready = cl->rnext))
+			srv->ready_tail = NULL;
+		cl->queued = 0;
+		if (serve_answer(srv, cl))
+			serve_queue(srv, cl);
+		serve_tend(srv, cl);
+		if (end)
+			break;
+	}
+}
+
+/* answer records sent to a unix socket at sockpath until SIGINT or SIGTERM */
+/* records end with delim, answer() writes each one's answer */
+int serve_run(const char *sockpath, int delim, serve_answer_t answer, void *ctx)
+{
+	struct epoll_event ev, evs[SERVE_EVENTS];
+	struct sigaction sa;
+	serve_t srv;
+	int n, i;
+
+#ifdef DEBUG
+	assert(NULL != sockpath);
+	assert(NULL != answer);
+#endif
+
+	/* no SA_RESTART, a signal has to get us out of epoll_wait() */
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = serve_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	srv.lfd = serve_listen(sockpath);
+	srv.full = 0;
+	srv.delim = delim;
+	srv.answer = answer;
+	srv.ctx = ctx;
+	srv.clients = NULL;
+	srv.ready = srv.ready_tail = NULL;
+	if (-1 == (srv.epfd = epoll_create1(EPOLL_CLOEXEC)))
+		err_bail(__FILE__, __LINE__, "could not create epoll");
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; /* the listening socket, clients have theirs */
+	if (-1 == epoll_ctl(srv.epfd, EPOLL_CTL_ADD, srv.lfd, &ev))
+		err_bail(__FILE__, __LINE__, "could not watch socket");
+
+	while (!Serve_Stop) {
+		/* don't sleep on anybody who's still waiting for a turn */
+		if (-1 == (n = epoll_wait(srv.epfd, evs, SERVE_EVENTS, NULL == srv.ready ? -1 : 0))) {
+			if (EINTR == errno)
+				continue;
+			err_bail(__FILE__, __LINE__, "epoll_wait failed");
+		}
+		for (i = 0; i < n; i++) {
+			serve_client_t *cl = evs[i].data.ptr;
+			if (NULL == cl) {
+				serve_accept(&srv);
+				continue;
+			}
+			/* a hangup with nothing left to read */
+			if (((evs[i].events & EPOLLIN) && -1 == serve_read(&srv, cl)) || (evs[i].events & EPOLLERR)
+				|| ((evs[i].events & EPOLLHUP) && !(evs[i].events & EPOLLIN))) {
+				serve_drop(&srv, cl);
+				continue;
+			}
+			if (!cl->queued) /* otherwise its turn is coming */
+				serve_tend(&srv, cl);
+		}
+		serve_turns(&srv);
+	}
+
+	while (NULL != srv.clients)
+		serve_drop(&srv, srv.clients);
+	close(srv.epfd);
+	close(srv.lfd);
+	unlink(sockpath);
+	return 0;
+}
+
@@ -0,0 +1,25 @@
+/* ex: set ts=4: */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdio.h>
+
+/*
+	shac --serve: a daemon on a unix socket that answers the same records
+	--batch reads off stdin, for as many clients at once as care to connect.
+	everything a session loads (users, groups, mounts, symlinks) stays
+	loaded between records, so an answer costs the lstat()s of its path and
+	little else. records are read and answers written without blocking off
+	one epoll loop, each client gets its answers back in the order it sent
+	the records. one thread answers everything, a record doesn't take long
+	enough to be worth more.
+*/
+
+/* answers the record, NUL-terminated with its delimiter dropped, onto out */
+typedef void (*serve_answer_t)(char *, FILE *, void *);
+
+int serve_run(const char *, int, serve_answer_t, void *);
+
+#endif
+
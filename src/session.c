@@ -0,0 +1,251 @@
+/* ex: set ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pwd.h> /* getpwnam, getpwuid */
+#include <limits.h> /* PATH_MAX */
+#include <unistd.h> /* getcwd */
+#include "mnt.h"
+#include "user.h"
+#include "session.h"
+#include "util.h"
+
+extern mnttab_t *MNTIDX; /* mount points */
+extern lnkcache_t *LNKCACHE; /* symlinks already read */
+extern bstat_t *PREFSTAT; /* lstat()s ahead of path_split() */
+extern statcache_t *STATCACHE; /* lstat()s path_split() has done */
+
+static void user_list_free(void *);
+static size_t userkey_hash(const char *);
+static userkey_t *userkey_find(session_t *, const char *);
+static void userkey_add(session_t *, const char *, user_t *);
+
+/* load everything a query needs that does not depend on the path being checked */
+/* user, groups and mounts are loaded exactly once and shared by every path */
+/* stay is set if we'll be answering more than the paths on the command line */
+session_t * session_open(const char *username, int stay)
+{
+	session_t *sess;
+
+#ifdef DEBUG
+	assert(NULL != username);
+#endif
+
+	sess = xmalloc(sizeof *sess);
+
+	/* relative paths are resolved against cwd */
+	sess->cwd = xmalloc(PATH_MAX);
+	if (NULL == getcwd(sess->cwd, PATH_MAX))
+		err_bail(__FILE__, __LINE__, "could not get current working directory");
+
+	/* resolve user and all their groups */
+	if (NULL == (sess->users = list_head_create()))
+		err_bail(__FILE__, __LINE__, "could not create sess->users");
+	vec_init(&sess->userkeys, sizeof(userkey_t), NULL, 0);
+	vec_init(&sess->userstrs, 1, NULL, 0);
+	sess->nuserkeys = 0;
+	if (NULL == (sess->user = session_user(sess, username)))
+		fatal_invalid_user(username);
+
+	/* load mntpt data, path_split() reads it from the global */
+	sess->mntlist = mnt_load();
+	sess->mnttab = mnttab_alloc(&sess->mntlist->mnts);
+	MNTIDX = sess->mnttab;
+	/* mounts come and go while we're up, see session_sync() */
+	sess->mntfd = (stay ? mnt_watch() : -1);
+
+	/* symlinks path_split() has read, batch mode runs into the same ones again */
+	sess->lnkcache = lnkcache_alloc();
+	LNKCACHE = sess->lnkcache;
+
+	/* on a slow fs path_split() lstat()s the rest of a path all at once */
+	sess->prefstat = bstat_alloc();
+	PREFSTAT = sess->prefstat;
+
+	/* queries that keep coming walk down the same dirs, no point lstat()ing */
+	/* them every time. a one-off run would only pay to set the cache up */
+	sess->statcache = (stay ? statcache_alloc() : NULL);
+	STATCACHE = sess->statcache;
+
+#ifdef DEBUG
+	session_dump(sess);
+#endif
+
+	return sess;
+}
+
+/* catch up on mounts that came or went since the last query, call before */
+/* each one. costs a poll() unless there's news, and the table is only */
+/* rebuilt if the news changed a mount we go by */
+void session_sync(session_t *sess)
+{
+	mntlist_t *mnts;
+#ifdef DEBUG
+	assert(NULL != sess);
+#endif
+	if (!mnt_changed(sess->mntfd))
+		return;
+	mnts = mnt_load();
+	if (mnt_same(sess->mntlist, mnts)) { /* propagation and such, nothing we go by */
+		mnt_unload(mnts);
+		return;
+	}
+	mnttab_free(sess->mnttab);
+	mnt_unload(sess->mntlist);
+	sess->mntlist = mnts;
+	sess->mnttab = mnttab_alloc(&sess->mntlist->mnts);
+	MNTIDX = sess->mnttab;
+	/* a dir something got mounted on isn't the dir that's cached for its path */
+	if (NULL != sess->statcache)
+		statcache_flush(sess->statcache);
+}
+
+/* list_free() callback for sess->users */
+static void user_list_free(void *v)
+{
+	user_free(v);
+}
+
+static size_t userkey_hash(const char *who)
+{
+	size_t h = 2166136261u; /* fnv-1a */
+	while ('\0' != *who)
+		h = (h ^ (unsigned char)*who++) * 16777619u;
+	return h;
+}
+
+/* who's slot in sess->userkeys, or the free one it would go in */
+static userkey_t *userkey_find(session_t *sess, const char *who)
+{
+	size_t mask = vec_len(&sess->userkeys) - 1, i;
+	userkey_t *k;
+	for (i = userkey_hash(who) & mask; ; i = (i + 1) & mask) {
+		k = vec_ptr(&sess->userkeys, userkey_t, i);
+		if (STROFF_NONE == k->who || 0 == strcmp(strtab_at(&sess->userstrs, k->who), who))
+			return k;
+	}
+}
+
+/* remember that who is user, so the next time nobody asks nss */
+static void userkey_add(session_t *sess, const char *who, user_t *user)
+{
+	userkey_t *k;
+	size_t i;
+	if ((sess->nuserkeys + 1) * 2 > vec_len(&sess->userkeys)) { /* keep it half empty */
+		vec_t old = sess->userkeys;
+		size_t n = (0 == vec_len(&old) ? 16 : vec_len(&old) * 2);
+		vec_init(&sess->userkeys, sizeof(userkey_t), NULL, 0);
+		vec_reserve(&sess->userkeys, n);
+		vec_truncate(&sess->userkeys, n);
+		for (i = 0; i < n; i++)
+			vec_at(&sess->userkeys, userkey_t, i).who = STROFF_NONE;
+		for (i = 0; i < vec_len(&old); i++)
+			if (STROFF_NONE != vec_at(&old, userkey_t, i).who)
+				*userkey_find(sess, strtab_at(&sess->userstrs, vec_at(&old, userkey_t, i).who))
+					= vec_at(&old, userkey_t, i);
+		vec_destroy(&old);
+	}
+	k = userkey_find(sess, who);
+	if (STROFF_NONE == k->who) {
+		k->who = strtab_add(&sess->userstrs, who, strlen(who));
+		sess->nuserkeys++;
+	}
+	k->user = user;
+}
+
+/* resolve a username or uid, loading each distinct user only once per session */
+/* a name or uid asked about before doesn't go to nss again, which is a */
+/* network round trip on hosts with ldap and such */
+/* returns NULL if no such user exists, so batch callers can keep going */
+user_t * session_user(session_t *sess, const char *who)
+{
+	struct passwd *pw;
+	list_node *node;
+	userkey_t *k;
+	user_t *user;
+	char *name;
+
+#ifdef DEBUG
+	assert(NULL != sess);
+	assert(NULL != who);
+#endif
+
+	if (vec_len(&sess->userkeys) > 0 && STROFF_NONE != (k = userkey_find(sess, who))->who)
+		return k->user;
+
+	if (strisnum(who))
+		pw = getpwuid((uid_t)atoi(who));
+	else
+		pw = getpwnam(who);
+	if (NULL == pw)
+		return NULL;
+
+	/* user_load() calls getpwnam() again, which clobbers pw */
+	if (NULL == (name = strdup(pw->pw_name)))
+		err_nomem(__FILE__, __LINE__, strlen(pw->pw_name) + 1);
+
+	/* a uid, or a name that isn't the one nss goes by, for a user we have */
+	if (vec_len(&sess->userkeys) > 0 && STROFF_NONE != (k = userkey_find(sess, name))->who) {
+		user = k->user;
+	} else {
+		user_t *loaded = user_load(name);
+		/* move user into the list, the node gets its own copy of the struct */
+		if (NULL == (node = list_node_create(loaded, sizeof *loaded)))
+			err_bail(__FILE__, __LINE__, "could not create user node");
+		if (NULL == list_append(sess->users, node))
+			err_bail(__FILE__, __LINE__, "could not append user node");
+		xfree(loaded);
+		user = list_node_data(node);
+		userkey_add(sess, name, user);
+	}
+	userkey_add(sess, who, user);
+	xfree(name);
+
+	return user;
+}
+
+void session_dump(const session_t *sess)
+{
+	mntpt_t *mnt;
+#ifdef DEBUG
+	assert(NULL != sess);
+#endif
+	printf("session_t(%p){\n\tcwd: \"%s\"\n", (void *)sess, sess->cwd);
+	user_dump(sess->user);
+	printf("\tusers: %d\n", (int)list_size(sess->users));
+	for (mnt = vec_first(&sess->mntlist->mnts, mntpt_t); mnt < vec_end(&sess->mntlist->mnts, mntpt_t); mnt++)
+		mntpt_dump(mnt);
+	printf("}\n");
+}
+
+/* tear down everything session_open() loaded */
+void session_close(session_t *sess)
+{
+#ifdef DEBUG
+	assert(NULL != sess);
+#endif
+	if (NULL == sess)
+		return;
+	if (MNTIDX == sess->mnttab)
+		MNTIDX = NULL;
+	mnttab_free(sess->mnttab);
+	mnt_unload(sess->mntlist);
+	if (-1 != sess->mntfd)
+		close(sess->mntfd);
+	if (LNKCACHE == sess->lnkcache)
+		LNKCACHE = NULL;
+	lnkcache_free(sess->lnkcache);
+	if (PREFSTAT == sess->prefstat)
+		PREFSTAT = NULL;
+	bstat_free(sess->prefstat);
+	if (STATCACHE == sess->statcache)
+		STATCACHE = NULL;
+	statcache_free(sess->statcache);
+	list_free(sess->users, user_list_free); /* includes sess->user */
+	vec_destroy(&sess->userkeys);
+	vec_destroy(&sess->userstrs);
+	xfree(sess->cwd);
+	xfree(sess);
+}
+
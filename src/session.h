@@ -0,0 +1,16 @@
+/* ex: set ts=4: */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "shac.h"
+
+/* session_t functions */
+session_t * session_open(const char *, int);
+user_t * session_user(session_t *, const char *);
+void session_sync(session_t *);
+void session_dump(const session_t *);
+void session_close(session_t *);
+
+#endif
+
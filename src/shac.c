@@ -34,6 +34,7 @@
 	#include <fstab.h> /* freebsd-ish:  */
 #endif
 #include <unistd.h> /* getcwd(), getopt() */
+#include <getopt.h> /* getopt_long() */
 #include <pwd.h> /* struct passwd, getpwnam */
 #include <grp.h> /* struct group, setgrent, getgrent, endgrent */
 #include <sys/stat.h> /* struct stat, stat */
@@ -42,6 +43,7 @@
 #include <errno.h> /* errno, of course */
 #include <sys/param.h> /* MAXSYMLINKS */
 #include <dirent.h> /* directory entry */
+#include <fcntl.h> /* openat, fstatat, AT_* */
 #include <limits.h> /* PATH_MAX */
 #include <stdarg.h>
 #include "llist.h"
@@ -50,9 +52,19 @@
 #include "perm.h"
 #include "user.h"
 #include "path.h"
+#include "dents.h"
+#include "bstat.h"
+#include "bjudge.h"
+#include "pscan.h"
+#include "session.h"
+#include "serve.h"
+#include "watch.h"
 #include "util.h"
 
 #define USAGE	"Usage: shac [-u user] [-p perms] file\n" \
+				"       shac [-u user] [-p perms] --batch [-0] < records\n" \
+				"       shac [-u user] [-p perms] --serve socket [-0]\n" \
+				"       shac [-u user] [-p perms] --watch [-0] < records\n" \
 				"Type shac -h to see details\n"
 
 #define HELP	"Usage: shac [options] file\n" \
@@ -69,6 +81,19 @@
 				"  -v         toggle verbose mode\n" \
 				"  -vv        toggle very verbose mode\n" \
 				"  -vvv       toggle very very verbose mode\n" \
+				"  -b         batch mode, read \"user perms path\" records from stdin\n" \
+				"             and print one result per record (long form --batch)\n" \
+				"             user or perms may be '-' to use the -u/-p defaults\n" \
+				"  -0         batch records are separated by NUL instead of newline\n" \
+				"  --serve socket\n" \
+				"             stay up and answer batch records sent to the unix\n" \
+				"             socket, one result line per record, until killed\n" \
+				"  --watch    answer batch records from stdin, then stay up and print\n" \
+				"             a record's result again whenever it changes, until\n" \
+				"             killed. each line starts with the record's number,\n" \
+				"             from 0. what's inside a dir checked for 'd' isn't watched\n" \
+				"  -j jobs    threads to check directory deletes with, defaults to\n" \
+				"             the number of CPUs. -vvv always checks with one\n" \
 				"\n" \
 				"Example: shac -u root -p rw /etc/hosts\n" \
 				"  checks if root can read and write the file /etc/hosts\n" \
@@ -130,10 +155,25 @@ static void reason_init(reason_t *);
 static void reason_dump(const void *);
 static void reason_free(reason_t *);
 
-static void perm_calc(const char *, const char *, permdsc_t *);
-static void report(reason_t *, user_t *);
-static void report_calc(reason_t *, path_t *, user_t *, perm_t, permdsc_t *, perm_t *, int);
-static int report_gen(list_head *, user_t *, permdsc_t *, int);
+static int perm_calc(session_t *, user_t *, const char *, permdsc_t *, vec_t *);
+static void perm_deps(pathvec_t *, vec_t *);
+static void batch_run(session_t *, permdsc_t *, int);
+static int batch_record(session_t *, permdsc_t *, permdsc_t *, char *, int, vec_t *);
+static void serve_answer(char *, FILE *, void *);
+static void watch_run(session_t *, permdsc_t *, int);
+static char *watch_answer(session_t *, permdsc_t *, permdsc_t *, const char *, int, vec_t *);
+static char *watch_settle(session_t *, permdsc_t *, permdsc_t *, watch_t *, size_t, const char *, int, vec_t *, vec_t *);
+static void report(reason_t *, const pathvec_t *);
+static int perm_relation(const path_t *, const user_t *);
+static void query_init(query_t *, permdsc_t *);
+static int query_last_dele(reason_t *, const path_t *, const user_t *, perm_t);
+static int report_calc(reason_t *, path_t *, user_t *, perm_t, const query_t *, int);
+static int report_gen(pathvec_t *, user_t *, const query_t *, int);
+static perm_t perm_effective(perm_t);
+static perm_t dele_scan(int, pathvec_t *, user_t *, const query_t *, perm_t, const reason_t *);
+static perm_t dele_check(pathvec_t *, int, user_t *, const query_t *, perm_t, const reason_t *);
+static int dele_judge(path_t *, perm_t, void *);
+static bjudge_mask_t dele_screen(const bstat_t *, size_t, perm_t, dev_t, void *);
 
 /* strictly for testing */
 static void test_stuff(void);
@@ -148,9 +188,32 @@ extern char *suboptarg;
 
 /* * * * * * * * * globals * * * * * * * * * * */
 
-list_head *MNTPTS; /* mount points */
+mnttab_t *MNTIDX; /* mount points */
+lnkcache_t *LNKCACHE; /* symlinks already read, path_split() looks here first */
+bstat_t *PREFSTAT; /* path_split() lstat()s the rest of a slow path on it */
+statcache_t *STATCACHE; /* lstat()s path_split() has done, for batch and serve */
 static list_head *VERBOSE_MSG; /* verbose output queue, to deal with output order issues */
 static unsigned Flag_Verbose = 0;
+static unsigned Flag_Batch = 0;
+static int Flag_Jobs = 0; /* threads for delete scans, 0 until we pick a default */
+static char *Flag_Serve = NULL; /* socket path for --serve */
+static unsigned Flag_Watch = 0;
+static FILE *Report_Out; /* answers go here, stdout unless --serve is answering a client */
+static bstat_t *Dele_Stat; /* batch lstat() for serial delete scans */
+
+/* what dele_judge() needs to know, shared read-only by pscan_run() workers */
+typedef struct {
+	user_t *user;
+	const query_t *q;
+} dele_ctx_t;
+
+/* what serve_answer() needs, the same for every record */
+typedef struct {
+	session_t *sess;
+	permdsc_t *defperms; /* -p, for records with '-' */
+	permdsc_t *perms; /* scratch */
+	int delim;
+} serve_ctx_t;
 
 static void Verbose(unsigned level, int append, const char *format, ...)
 {
@@ -211,6 +274,7 @@ static void reason_init(reason_t *reas)
 	reas->yes = REAS_NONE;
 	reas->no = REAS_NONE;
 	reas->path = NULL;
+	reas->name.abspath = reas->name.component = reas->name.symlink = STROFF_NONE;
 }
 
 static void reason_dump(const void *v)
@@ -239,56 +303,53 @@ static void reason_free(reason_t *reas)
 }
 
 
+/* translate what CREA and DELE really mean in terms of perms we check */
+static perm_t perm_effective(perm_t permeff)
+{
+	if (permeff & PERM_CREA) {
+		permeff |= PERM_WRIT; /* ensure WRIT on */
+		permeff ^= PERM_CREA; /* turn CREA off */
+	} else if (permeff & PERM_DELE) {
+		permeff |= PERM_WRIT;
+	}
+	return permeff;
+}
+
 /* main reporting function, once we've goat all necessary data */
 /* output: 0: silent, 1: normal, 2: only report errors */
-/* */
-static int report_gen(list_head *paths, user_t *user, permdsc_t *permreq, int output)
+static int report_gen(pathvec_t *paths, user_t *user, const query_t *q, int output)
 {
 	perm_t reasmask = REAS_NONE; /* permanent mask, carries sticky mask */
-	perm_t permeff = PERM_NONE; /* effective local copy of permreq, because it may change */
-	list_node *node;
 	reason_t *reas;
+	reason_t chain; /* first entry we couldn't get past on the way to the last */
+	path_t chainpath; /* chain.path, paths moves when dele_scan() pushes onto it */
 	path_t *path;
+	size_t i;
 	int able = 1, last_entry;
 
 #ifdef DEBUG
 	assert(NULL != paths);
 	assert(NULL != user);
-	assert(NULL != permreq);
+	assert(NULL != q);
 #endif
 
 #ifdef DEBUG
-	printf("report_gen:%d paths(%p), user(%p), permreq(%p), output:%d ",
-		__LINE__, (void *)paths, (void *)user, (void *)permreq, output);
-	list_dump(paths, path_dump);
+	printf("report_gen:%d paths(%p), user(%p), q(%p), output:%d ",
+		__LINE__, (void *)paths, (void *)user, (void *)q, output);
+	pathvec_dump(paths);
 #endif
 
 	reas = reason_alloc();
-
-	permeff = permreq->mask;
-
-	/* translate what CREA and DELE really mean */
-	if (permeff & PERM_CREA) {
-		permeff |= PERM_WRIT; /* ensure WRIT on */
-		permeff ^= PERM_CREA; /* turn CREA off */
-	} else if (permeff & PERM_DELE) {
-		permeff |= PERM_WRIT;
-	}
+	reason_init(&chain);
 
 #ifdef DEBUG
 		printf("report_gen:%d ", __LINE__);
-		list_dump(paths, path_dump);
+		pathvec_dump(paths);
 #endif
 
-	for (node = list_first(paths); node != NULL; node = list_node_next(node)) {
-		last_entry = (node == list_last(paths));
-		path = node->data;
-
-#if 0
-		if (last_entry)
-			if (!path_is_dir(path) && (permeff | PERM_DELE))
-				permeff ^= PERM_DELE; /* DELE only matters for dir */
-#endif
+	for (i = 0; i < pathvec_len(paths); i++) {
+		last_entry = (i == pathvec_len(paths) - 1);
+		path = pathvec_path(paths, i);
 
 		if (path_is_sticky(path))
 			reasmask |= REAS_NO_STICKY;
@@ -298,25 +359,34 @@ static int report_gen(list_head *paths, user_t *user, permdsc_t *permreq, int ou
 		path_dump(path);
 #endif
 
-		report_calc(reas, path, user, reasmask, permreq, &permeff, last_entry);
+		if (report_calc(reas, path, user, reasmask, q, last_entry)) {
+			reas->no |= dele_scan(AT_FDCWD, paths, user, q, reasmask,
+				(1 == able ? NULL : &chain));
+			reas->path = path = pathvec_path(paths, i); /* may have moved */
+		}
+		reas->name = *pathvec_name(paths, i);
 
 #ifdef DEBUG
-		printf("report_gen:%d path->abspath:\"%s\", reas->no:%d\n",
-			__LINE__, path->abspath, reas->no);
+		printf("report_gen:%d abspath:\"%s\", reas->no:%d\n",
+			__LINE__, pathvec_abspath(paths, i), reas->no);
 
 		reason_dump(reas);
 #endif
 
-		if (1 == able && PERM_NONE != reas->no) /* user unable */
+		if (1 == able && PERM_NONE != reas->no) { /* user unable */
 			able = 0;
+			chain = *reas;
+			chainpath = *path;
+			chain.path = &chainpath;
+		}
 
 		/* actually print report if output all or err and output err */
 		if (Flag_Verbose >= 1 && OUTPUT_ALL == output) {
 			/* normal stuff */
-			report(reas, user);
+			report(reas, paths);
 		} else if (Flag_Verbose >= 3 && (OUTPUT_ERR == output && 0 == able)) {
 			/* print each file that failed a test if we're on verbosity level 3 */
-			report(reas, user);
+			report(reas, paths);
 		}
 
 		/* we're in recursive mode and shouldn't go any farther */
@@ -324,20 +394,14 @@ static int report_gen(list_head *paths, user_t *user, permdsc_t *permreq, int ou
 			break;
 	}
 
-#if 0
-	printf("report_gen:%d path->abspath:\"%s\", able:%d\n",
-		__LINE__, path->abspath, able);
-#endif
-
 	/* final line of output */
 	if (OUTPUT_ALL == output) {
-		path_t *path = ((path_t *)(list_last(paths)->data));
-		printf("%s user %s %s perms %s on file %s\n",
+		fprintf(Report_Out, "%s user %s %s perms %s on file %s\n",
 			(able ? "OK" : "!!"), /* lead */
 			user->name,
 			(able ? "has" : "doesn't have"),
-			permreq->dsc,
-			path->abspath
+			q->permreq->dsc,
+			pathvec_abspath(paths, pathvec_len(paths) - 1)
 		);
 	}
 
@@ -351,355 +415,348 @@ static int report_gen(list_head *paths, user_t *user, permdsc_t *permreq, int ou
 
 }
 
+/* PERM_REL_* of user to path, for perm_access() */
+/* the group is only looked up if path has group bits that could let them in */
+static int perm_relation(const path_t *path, const user_t *user)
+{
+	int rel = 0;
+	if (path->uid == user->uid)
+		rel |= PERM_REL_OWNER;
+	if (UID_ROOT == user->uid)
+		rel |= PERM_REL_ROOT;
+	if ((path->mode & S_IRWXG) && user_in_group(user, path->gid))
+		rel |= PERM_REL_GROUP;
+	return rel;
+}
+
+/* the perms asked for decide everything report_calc() does besides looking */
+/* at the file, so that's worked out here once per query */
+static void query_init(query_t *q, permdsc_t *permreq)
+{
+	q->permreq = permreq;
+	q->permeff = perm_effective(permreq->mask);
+	/* in *MOST* cases we only need exec to get to the next dir */
+	q->start[0][0] = q->start[0][1] = REAS_NO_EXEC;
+	q->start[1][0] = q->start[1][1] = q->permeff;
+	q->last = NULL;
+	if (q->permeff & PERM_DELE) {
+		/* special case for deleting directory */
+		q->start[1][1] |= (REAS_NO_READ | REAS_NO_WRIT | REAS_NO_EXEC);
+		q->last = query_last_dele;
+	}
+}
+
+/* last entry of a delete, reas has the rwx verdict */
+/* returns 1 if path is a directory whose contents must be checked by dele_scan() */
+static int query_last_dele(reason_t *reas, const path_t *path, const user_t *user, perm_t reasmask)
+{
+	if (!path_is_dir(path)) { /* can we delete existing file? */
+#ifdef DEBUG
+		printf("%d reasmask: %d, path->uid: %d, user->uid: %d\n",
+			__LINE__, reasmask, path->uid, user->uid);
+#endif
+		/* get rid of REAS_NO_DELE because it's a meta-reason, not a real one */
+		reas->no ^= REAS_NO_DELE;
+
+		/* if is owner or root... */
+		if (path->uid == user->uid || UID_ROOT == user->uid) {
+			/* may delete normal file even with all perms off */
+			reas->no = REAS_NONE;
+			reas->yes |= (UID_ROOT == user->uid ? REAS_YES_ROOT : REAS_YES_OWNER);
+		} else if (reasmask & REAS_NO_STICKY) { /* non-owner, file exists inside a sticky dir */
+			reas->no |= REAS_NO_STICKY;
+		}
+		return 0;
+	}
+
+	/* can we delete existing dir? */
+	if (REAS_NONE == (reas->no & (REAS_NO_READ | REAS_NO_WRIT | REAS_NO_EXEC)))
+		reas->no ^= PERM_DELE;
+
+	/* root can delete everything */
+	if (UID_ROOT == user->uid) {
+		reas->no = REAS_NONE;
+		return 0; /* no need to check further */
+	}
+
+	/* if things are successful for this dir, everything under it has to be checked too */
+	return (REAS_NONE == reas->no); /* caller runs dele_scan() */
+}
+
 /* figure out if we have abilities on this path */
 /* reas: is empty, holds return value */
 /* path: contains all info about path we're checking */
 /* user: user we're checking on */
 /* reasmask: holds sticky mask, if present */
-/* permreq: passed in case we need to do recursive delete checking */
-/* permeff: perms we're checking on */
+/* q: the query, see query_init() */
 /* last_entry: 1 if last item in list */
-static void report_calc(reason_t *reas, path_t *path, user_t *user, perm_t reasmask, permdsc_t *permreq, perm_t *permeff, int last_entry)
+/* returns 1 if path is a directory whose contents must be checked by dele_scan() */
+static int report_calc(reason_t *reas, path_t *path, user_t *user, perm_t reasmask, const query_t *q, int last_entry)
 {
-
-#if 0
-	printf("%%%%%%%%%%%%%%%% report_calc:%d launched for \"%s\"\n", __LINE__, path->abspath);
-#endif
+	perm_t want, yes;
 
 #ifdef DEBUG
 	assert(NULL != reas);
 	assert(NULL != path);
 	assert(NULL != user);
-	assert(NULL != permeff);
+	assert(NULL != q);
 #endif
 
 	reason_init(reas);
+	reas->path = path;
 
 #ifdef DEBUG
 	printf("report_calc:%d(%p, %p) path_dump(%p)\n",
 		__LINE__, (void *)path, (void *)user, (void *)path);
-	reason_dump(reas);
-#endif
-	reas->path = path;
-
-#ifdef DEBUG
-	printf("report_calc:%d path->mode: %d\n", __LINE__, path->mode);
+	path_dump(path);
 #endif
 
-	if (path_status_not_ok(path)) {
-		reas->label = RPT_NOT_OK;
-	} else if (path_is_symlink(path)) {
-		reas->label = RPT_SYMLNK; /* set label for output, do nothing else */
-	} else {
+	if (path_status_not_ok(path) || path_is_symlink(path)) {
+		/* set label for output, do nothing else */
+		reas->label = (path_status_not_ok(path) ? RPT_NOT_OK : RPT_SYMLNK);
+		return 0;
+	}
 
-		char mntpt_bail; /* mntpt perms make dir checking unnecessary */
-		/* end decl */
-		
-		mntpt_bail = 0;
-		/* for every file we assume that we don't have the permissions that we want... */
-		/* if we are able to disprove these pessimistic assumptions, user CAN access file */
-		reas->no = *permeff;
+	/* for every file we assume that we don't have the permissions that we want... */
+	/* if we are able to disprove these pessimistic assumptions, user CAN access file */
+	reas->no = q->start[last_entry][0];
 
-#if DEBUG && 0
-		printf("report_calc:%d path->mode: %d\n", __LINE__, path->mode);
-#endif
+	if (path_is_mntpt(path) && (reas->no & PERM_WRIT) && mntpt_is_readonly(path->mntpt)) {
+		/* write required and mounted ro, mntpt restrictions trump fs perms */
+		reas->no |= REAS_NO_MNTPT_RO;
+	} else {
+		reas->no = q->start[last_entry][path_is_dir(path)];
+		/* test read, write and exec in one go */
+		want = reas->no & (REAS_NO_READ | REAS_NO_WRIT | REAS_NO_EXEC);
+		yes = perm_access(path->mode, perm_relation(path, user)) & perm_yes_mask(want);
+		reas->yes |= yes;
+		reas->no ^= perm_granted(yes);
+	}
 
-		/* adjust required perms based on where in the path we currently are */
-		if (!last_entry) /* not final file */
-			reas->no = REAS_NO_EXEC; /* in *MOST* cases we only need exec to get to the next dir */
+	if (last_entry && NULL != q->last) /* final dir/file */
+		return q->last(reas, path, user, reasmask);
+	return 0;
+}
 
-		/* check mounts */
-		if (path_is_mntpt(path)) {
-			if ((reas->no & PERM_WRIT) && mntpt_is_readonly(path->mntpt)) {
-				/* write required and mounted ro */
-				reas->no |= REAS_NO_MNTPT_RO;
-				mntpt_bail = 1; /* mntpt restrictions trump fs perms */
-			}
-		}
+/*
+	in order to delete a directory, we need the ability to delete every single
+	file and directory recursively underneath it. we search the directory tree
+	for any file that we *CAN'T* delete, respecting sticky bits, uid, gid, etc.
+	if we don't find anything we can't delete, then the user would be able to
+	delete this directory.
+
+	the idea is to recurse breadth-first, showing only errors for files we can't
+	delete. assuming no errors in current level, recurse into dirs and do same.
+
+	entries are stat'ed relative to the open directory and ride on the end of
+	paths while they're judged; their abspath is only built if they have to be
+	reported or might be a mount point. the dirs above an entry have already
+	been judged, so only the entry itself is checked, see dele_check().
+*/
+/* dirfd: directory the last entry of paths lives in, AT_FDCWD to open it by abspath */
+/* reasmask: sticky mask carried down to and including the directory */
+/* chain: why we can't get to the directory, NULL if we can */
+/* returns REAS_NONE if everything underneath could be deleted, why not otherwise */
+static perm_t dele_scan(int dirfd, pathvec_t *paths, user_t *user, const query_t *q, perm_t reasmask, const reason_t *chain)
+{
+	path_t entpath, *child;
+	pathname_t entname;
+	mntpt_t *dirmnt;
+	pathvec_t dir_list;
+	struct stat dirst, st;
+	dents_t *dents;
+	bstat_ent_t *ent;
+	bjudge_mask_t look;
+	size_t n, i, strmark;
+	perm_t res = REAS_NONE;
+	int fd, able = 1;
 
 #ifdef DEBUG
-#if 0
-		printf("report_calc:%d reas->yes:%d, reas->no:%d, mntpt_bail:%d\n",
-			__LINE__, reas->yes, reas->no, mntpt_bail);
-#endif
+	assert(NULL != paths);
+	assert(NULL != user);
+	assert(NULL != q);
 #endif
 
-		if (!mntpt_bail) {
+	dirmnt = pathvec_last(paths)->mntpt;
+
+	if (AT_FDCWD == dirfd) /* one of the path_split() entries, they have it */
+		fd = open(pathvec_at(paths, pathvec_name(paths, pathvec_len(paths) - 1)->abspath), O_RDONLY | O_DIRECTORY);
+	else
+		fd = openat(dirfd, pathvec_at(paths, pathvec_name(paths, pathvec_len(paths) - 1)->component), O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	if (-1 == fd)
+		return REAS_NO_CERTAIN;
+	if (-1 == fstat(fd, &dirst) || NULL == (dents = dents_open(fd))) {
+		close(fd);
+		return REAS_NO_CERTAIN;
+	}
 
-			/* special case for deleting directory */
-			if (last_entry) {
-				if (path_is_dir(path)) {
-					if (reas->no & PERM_DELE) {
-						reas->no |= (REAS_NO_READ | REAS_NO_WRIT | REAS_NO_EXEC);
-					}
-				}
+	/* subdirs wait here until this level checks out, most levels have none */
+	/* and it doesn't malloc() until the first one */
+	pathvec_init(&dir_list);
+
+	if (NULL == Dele_Stat)
+		Dele_Stat = bstat_alloc(); /* one is enough, a level is done reading before we go down */
+
+	/* names of the entries riding on paths go after this, and go away with them */
+	strmark = vec_len(&paths->strs);
+	entname.abspath = entname.symlink = STROFF_NONE;
+
+	/* owner only matters under a sticky dir, so symlinks needn't be stat'ed outside one */
+	while (0 < (n = bstat_read(Dele_Stat, dents, !(reasmask & REAS_NO_STICKY) && NULL == chain, dirst.st_dev))) {
+		/* files the user could delete go by without a word, the rest get a closer look */
+		look = (NULL == chain ? bjudge_batch(Dele_Stat, n, user, q->permeff, reasmask, dirst.st_dev) : BJUDGE_ALL(n));
+		for (i = 0, ent = Dele_Stat->ents; i < n; i++, ent++) {
+			if (!(look & ((bjudge_mask_t)1 << i)))
+				continue;
+			if (0 != ent->err) {
+				if (ENOENT == ent->err)
+					continue; /* deleted under us, one less to worry about */
+				res |= REAS_NO_CERTAIN;
+				able = 0;
+				continue;
 			}
-
-			/* test read */
-			if (reas->no & REAS_NO_READ) {
-				if (((path->mode & S_IRUSR) && path->uid == user->uid) || UID_ROOT == user->uid) {
-				/* readable by owner and user is owner */
-					reas->no ^= REAS_NO_READ;
-					reas->yes |= REAS_YES_UR;
-				} else if ((path->mode & S_IRGRP) && user_in_group(user, path->gid)) {
-				/* readable by group */
-					reas->no ^= REAS_NO_READ;
-					reas->yes |= REAS_YES_GR;
-				} else if (0 != (path->mode & S_IROTH)) { /* readable by other */
-					reas->no ^= REAS_NO_READ;
-					reas->yes |= REAS_YES_OR;
-#ifdef DEBUG
-				} else { /* file is unreadable and read is required */
-					
-#endif
-				}
+			st = ent->st;
+
+			/* the entry rides on the end of paths while it's judged */
+			path_init(&entpath);
+			entpath.mode = st.st_mode;
+			entpath.uid = st.st_uid;
+			entpath.gid = st.st_gid;
+			entpath.mntpt = dirmnt;
+			entname.component = strtab_add(&paths->strs, ent->name, strlen(ent->name));
+			child = pathvec_push(paths, &entpath, &entname);
+
+			if (st.st_dev != dirst.st_dev) { /* something is mounted here */
+				const char *abspath = path_chain_abspath(paths, pathvec_len(paths) - 1);
+				mntpt_t *mnt = mnttab_at(MNTIDX, fd, ent->name);
+				if (NULL == mnt) /* kernel won't say, see if dev alone picks it out */
+					mnt = mnttab_dev(MNTIDX, st.st_dev);
+				if (NULL == mnt)
+					mnt = mnttab_find(MNTIDX, abspath);
+				if (NULL != mnt)
+					child->mntpt = mnt;
+				if (NULL != child->mntpt && 0 == strcmp(abspath, child->mntpt->mntdir))
+					child->flags |= PATH_MNTPT;
 			}
 
-#if DEBUG && 0
-			printf("report_calc:%d path->mode: %d\n", __LINE__, path->mode);
-#endif
-
-			/* test write */
-			if (reas->no & REAS_NO_WRIT) {
-				if (((path->mode & S_IWUSR) && path->uid == user->uid) || UID_ROOT == user->uid) {
-				/* writeable by owner and user is owner */
-					reas->no ^= REAS_NO_WRIT;
-					reas->yes |= REAS_YES_UW;
-
-				} else if ((path->mode & S_IWGRP) && user_in_group(user, path->gid)) {
-				/* writeable by group */
-					reas->no ^= REAS_NO_WRIT;
-					reas->yes |= REAS_YES_GW;
-				} else if (0 != (path->mode & S_IWOTH)) { /* writeable by other */
-					reas->no ^= REAS_NO_WRIT;
-					reas->yes |= REAS_YES_OW;
-#ifdef DEBUG
-				} else { /* file is unwriteable and write is required */
-					
-#endif
+			if (!S_ISDIR(st.st_mode)) {
+				if (REAS_NONE != dele_check(paths, fd, user, q, reasmask, chain)) { /* run for every entry in current dir */
+					able = 0;
+					res |= REAS_NO_DEPENDANCY;
 				}
+			} else {
+				/* save for later, we only go into dirs once this level checks out */
+				pathvec_copy(&dir_list, paths, pathvec_len(paths) - 1);
 			}
 
-#if DEBUG && 0
-			printf("report_calc:%d path->mode: %d\n", __LINE__, path->mode);
-#endif
-
-			/* test exec */
-			if (reas->no & REAS_NO_EXEC) {
-#if DEBUG && 0
-				printf("report_calc:%d reas->yes:%d, reas->no:%d\n", __LINE__, reas->yes, reas->no);
-#endif
+			pathvec_pop(paths);
+			pathvec_release(paths, strmark);
+		} /* batch loop */
+	} /* dents loop */
 
-				if (
-					/* special root case... "x" must be turned on somewhere or even root cannot x it */
-					(UID_ROOT == user->uid && (path->mode & (S_IXUSR | S_IXGRP | S_IXOTH))) ||
-					((path->mode & S_IXUSR) && path->uid == user->uid) /* regular case */
-				){ /* writeable by owner and user is owner */
-#ifdef DEBUG
-#if 0
-					printf("report_calc:%d path->uid:%d, user->uid:%d\n",
-						__LINE__, path->uid, user->uid);
-#endif
-#endif
-					reas->no ^= REAS_NO_EXEC;
-					reas->yes |= REAS_YES_UX;
-				} else if ((path->mode & S_IXGRP) && user_in_group(user, path->gid)) {
-				/* execable by group */
-					reas->no ^= REAS_NO_EXEC;
-					reas->yes |= REAS_YES_GX;
-				} else if ((path->mode & S_IXOTH)) { /* execable by other */
-					reas->no ^= REAS_NO_EXEC;
-					reas->yes |= REAS_YES_OX;
-#ifdef DEBUG
-					printf("report_calc:%d reas->yes: %d\n", __LINE__, reas->yes);
-				} else { /* file is unexecable and exec is required */
-					fprintf(stderr, "can't exec!!!! (\"%s\"=%d)\n", path->abspath, path->mode);
-#endif
-				}
+	if (0 != dents->err) { /* we didn't see everything */
+		res |= REAS_NO_CERTAIN;
+		able = 0;
+	}
+	dents_close(dents); /* fd stays open for the subdirs */
+
+	if (0 == pathvec_len(&dir_list)) {
+		/* leaf, nothing more to check */
+	} else if (1 == able && Flag_Jobs > 1 && Flag_Verbose < 3 && NULL == chain) {
+		/* nobody wants to hear about each entry, so the subtrees can be checked in parallel */
+		dele_ctx_t ctx;
+		ctx.user = user;
+		ctx.q = q;
+		res |= pscan_run(fd, &dir_list, reasmask, Flag_Jobs, dele_judge, dele_screen, &ctx);
+	} else if (1 == able) { /* if no problems at current level, recurse down */
+		for (i = 0; i < pathvec_len(&dir_list); i++) {
+			perm_t sub;
+			pathvec_copy(paths, &dir_list, i);
+			sub = dele_check(paths, fd, user, q, reasmask, chain);
+			pathvec_pop(paths);
+			pathvec_release(paths, strmark);
+			if (REAS_NONE != sub) { /* what pscan_run() would say about it */
+				res |= REAS_NO_DEPENDANCY | (sub & REAS_NO_CERTAIN);
+				break;
 			}
-		} /* if mntpt_bail */
-
-		if (last_entry) { /* final dir/file */
-			/* do a final check if we've got what it takes to create/delete this file */
-			if (!path_is_dir(path)) {
-				if (reas->no & PERM_CREA) { /* can user create a file that already exists... */
-					/* FIXME: what do we do here? */
-				} else if (reas->no & PERM_DELE) { /* can we delete existing file? */
-#ifdef DEBUG
-					printf("%d reasmask: %d, path->uid: %d, user->uid: %d\n",
-						__LINE__, reasmask, path->uid, user->uid);
-#endif
-
-					/* get rid of REAS_NO_DELE because it's a meta-reason, not a real one */
-					reas->no ^= REAS_NO_DELE;
-
-					/* if is owner or root... */
-					if (path->uid == user->uid || UID_ROOT == user->uid) {
-						/* may delete normal file even with all perms off */
-						reas->no = REAS_NONE;
-						if (UID_ROOT == user->uid) {
-							reas->yes |= REAS_YES_ROOT;
-						} else {
-							reas->yes |= REAS_YES_OWNER;
-						}
-					} else { /* non-owner */
-						if (reasmask & REAS_NO_STICKY) { /* file exists inside a sticky dir */
-							reas->no |= REAS_NO_STICKY;
-						}
-					}
-
-				}
-			} else { /* referring to a directory */
-				if (reas->no & PERM_CREA) { /* can user create a new file inside this directory? */
-					if (reasmask & REAS_NO_STICKY) { /* sticky encountered */
-						if (path->uid != user->uid) { /* not the owner of current dir! */
-							reas->no |= REAS_NO_STICKY;
-						}
-					}
-				} else if (reas->no & PERM_DELE) { /* can we delete existing dir? */
-/*
-	this gets tricky. in order to delete a directory, we need the ability to delete
-	every single file and directory recursively underneath it. we need to write code
-	that will search a directory tree for any file that we *CAN'T* delete, respecting
-	sticky bits, uid, gid, etc. if we don't find anything we can't delete, then the
-	user would be able to delete this directory.
-
-	recursively searching a directory could take a lot of machine time and machine resources...
-
-	the idea is to recurse bread-first, showing only error for files we can't delete. assuming
-	no errors in current level, recurse into dirs and do same
-
-	FIXME: this whole block is its own function, but is so tightly tied it wouldn't make sense
-	to rip it out. redesign would be good.
-*/
-					if (REAS_NONE == (reas->no & (REAS_NO_READ | REAS_NO_WRIT | REAS_NO_EXEC))) {
-						reas->no ^= PERM_DELE;
-					}
+		}
+	}
 
-					/* root can delete everything */
-					if (UID_ROOT == user->uid) {
-						reas->no = REAS_NONE;
-						return; /* no need to check further */
-					}
+	close(fd);
+	pathvec_destroy(&dir_list);
+	pathvec_release(paths, strmark);
 
-					if (REAS_NONE == reas->no) { /* if things are successful for this dir... */
+	return res;
+}
 
-						DIR *dir;
-						list_head *dir_list;
-						list_node *dir_node;
-						struct dirent *ent;
-						perm_t dir_perms;
-						int able = 1;
+/* judge one entry found by dele_scan(), riding at the end of paths */
+/* the verdict for every dir above it is carried in reasmask and chain */
+/* returns REAS_NONE if user could delete it, why not if not */
+static perm_t dele_check(pathvec_t *paths, int fd, user_t *user, const query_t *q, perm_t reasmask, const reason_t *chain)
+{
+	reason_t reas;
+	path_t *path = pathvec_last(paths);
 
-						if (NULL == (dir = opendir(path->abspath))) {
-#if 0
-							err_opendir(__FILE__, __LINE__, path->abspath);
-#endif
-							reas->no |= REAS_NO_CERTAIN;
-							return;
-						}
-
-						dir_list = list_head_create();
-						dir_perms = REAS_NO_DEPENDANCY; /* assume there are undeletable child files */
-						
-						while (NULL != (ent = readdir(dir))) {
-							struct stat st;
-							list_head *target, *paths;
-							char *abspath;
-							/* end decl */
-#if 0
-							printf("report_calc:%d ent->d_name:\"%s\"\n",
-								__LINE__, ent->d_name);
-#endif
-							if (0 == strcmp(ent->d_name, ".") || 0 == strcmp(ent->d_name, ".."))
-								continue; /* skip "special" entries */
+	if (NULL != chain) { /* stuck somewhere above, nothing down here is reachable */
+		if (Flag_Verbose >= 3) {
+			reas = *chain;
+			report(&reas, paths);
+		}
+		return chain->no;
+	}
 
-							/* FIXME: this is inefficient... */
-							abspath = strdup(path->abspath);
-							abspath = strcapp(abspath, PATHSEP);
-							abspath = strapp(abspath, ent->d_name);
-#if 0
-							printf("report_calc:%d path->abspath:\"%s\", abspath:\"%s\"\n",
-								__LINE__, path->abspath, abspath);
-							str_examine(abspath);
-#endif
-							if (-1 == lstat(abspath, &st)) /* stat file (don't follow symlinks) */
-								err_cantopen(__FILE__, __LINE__, abspath); /* or die trying */
-							target = path_calc_target(abspath, NULL); /* cwd == NULL */
-							paths = path_split(&target, DONT_FOLLOW);
+	if (path_is_sticky(path))
+		reasmask |= REAS_NO_STICKY;
 
-/*
-NOTE: next block contains the behavior for the recursion...
-*/
+	if (report_calc(&reas, path, user, reasmask, q, 1)) {
+		reas.no |= dele_scan(fd, paths, user, q, reasmask, NULL);
+		reas.path = pathvec_last(paths); /* may have moved */
+	}
 
-							if (!S_ISDIR(st.st_mode)) { /* if no problems so far, save dirs, otherwise we'll never go into them */
-								if (0 == report_gen(paths, user, permreq, OUTPUT_ERR)) { /* run for every entry in current dir */
-									able = 0;
-									reas->no |= REAS_NO_DEPENDANCY;
-								}
-								list_free(paths, path_free);
-							} else {
-								/* save in a list for later processing */
-								dir_node = list_node_create(paths, sizeof(list_head)); /* create list node */
-								if (NULL == list_append(dir_list, dir_node)) /* append or die trying */
-									err_bail(__FILE__, __LINE__, "could not append dir_node to dir_list");
-								list_head_free(paths);
-							}
-							list_free(target, NULL); /* always free target */
-							free(abspath);
-						} /* readdir loop */
-
-						closedir(dir);
-
-						if (1 == able) { /* if no problems at current level, recurse down */
-#if 0
-							printf("report_calc:%d able==1 for \"%s\"\n", __LINE__, path->abspath);
-#endif
-							/* if we found any subdirs, search them too */
-							for (dir_node = list_first(dir_list); dir_node != NULL; dir_node = list_node_next(dir_node)) {
+	if (REAS_NONE == reas.no)
+		return REAS_NONE;
 
-								/* dir_node represents a node with a list_head for another list as its data */
-#if 0
-								printf("report_calc:%d\n", __LINE__);
-								list_dump(list_node_data(dir_node), list_dump_cb_chars);
-#endif
-								if (0 == report_gen(list_node_data(dir_node), user, permreq, OUTPUT_ERR)) {
-									reas->no |= REAS_NO_DEPENDANCY;
-									break;
-								}
-							}
-						}
-
-						list_free(dir_list, shac_list_list_free); /* free list */
-					}
-				}
-			}
-		} /* if last_entry */
-	} /* if symlink */
-	/* report on what we've found */
+	/* print each file that failed a test if we're on verbosity level 3 */
+	if (Flag_Verbose >= 3) {
+		path_chain_abspath(paths, pathvec_len(paths) - 1); /* scanned entries are named only when reported */
+		reas.name = *pathvec_name(paths, pathvec_len(paths) - 1);
+		report(&reas, paths);
+	}
+	return reas.no;
+}
 
-#ifdef DEBUG
-#if 0
-	printf("report_calc:%d ", __LINE__);
-	reason_dump(&reas);
-#endif
-#endif
+/* pscan_run() callback, judges one entry without descending into it */
+static int dele_judge(path_t *path, perm_t reasmask, void *v)
+{
+	dele_ctx_t *ctx = v;
+	reason_t reas;
 
+	if (report_calc(&reas, path, ctx->user, reasmask, ctx->q, 1))
+		return PSCAN_DESCEND;
+	return (REAS_NONE == reas.no ? PSCAN_OK : PSCAN_FAIL);
 }
 
+/* pscan_run() callback, picks out the entries of a batch dele_judge() needs to see */
+static bjudge_mask_t dele_screen(const bstat_t *bst, size_t n, perm_t reasmask, dev_t dev, void *v)
+{
+	dele_ctx_t *ctx = v;
+	return bjudge_batch(bst, n, ctx->user, ctx->q->permeff, reasmask, dev);
+}
 
 /* actually produce output to the screen for a single */
-static void report(reason_t *reas, user_t *user)
+/* reas->name is in the string table of paths */
+static void report(reason_t *reas, const pathvec_t *paths)
 {
 	path_t *path;
 	mntpt_t *mntpt;
+	const char *abspath;
 	char comma = 0; /* flag as to whether to print a comma or not */
 #ifdef DEBUG
 	assert(NULL != reas);
-	assert(NULL != user);
 #endif
 	path = reas->path;
 	mntpt = path->mntpt;
+	abspath = pathvec_str(paths, reas->name.abspath);
 
 #ifdef DEBUG
 	printf("report:%d reas: ", __LINE__);
@@ -714,25 +771,25 @@ static void report(reason_t *reas, user_t *user)
 #endif
 
 	if (path_is_symlink(path)) { /* symlink output */
-		printf("%s %s -> %s", RPT_LABELS[reas->label],
-			path->abspath, path->symlink);
+		fprintf(Report_Out, "%s %s -> %s", RPT_LABELS[reas->label],
+			abspath, pathvec_str(paths, reas->name.symlink));
 		if (STATUS_OK != path->status) { /* report status */
-			printf(" %s", RPT_STATUS[log2(path->status)]);
+			fprintf(Report_Out, " %s", RPT_STATUS[log2(path->status)]);
 		}
 	} else { /* non-symlink */
 		reas->label = (reas->no ? RPT_NOT_OK : RPT_OK);
-		printf("%s %s", RPT_LABELS[reas->label], path->abspath); /* output label and filename */
+		fprintf(Report_Out, "%s %s", RPT_LABELS[reas->label], abspath); /* output label and filename */
 		/* status means there was a fundamental error with the file */
 		/* we just print out the status, not extra info */
 		if (STATUS_OK != path->status) { /* report status */
-			printf(" %s", RPT_STATUS[log2(path->status)]);
+			fprintf(Report_Out, " %s", RPT_STATUS[log2(path->status)]);
 		} else {
 			/* print things we CAN do, even if ultimately we're unsuccessful */
-			printf(" (");
+			fprintf(Report_Out, " (");
 			if (REAS_NONE != reas->yes) {
 				/* print "user" perms that helped us */
 				if (REAS_NONE != (reas->yes & (REAS_YES_UR | REAS_YES_UW | REAS_YES_UX))) {
-					printf("%s+%s%s%s",
+					fprintf(Report_Out, "%s+%s%s%s",
 						STR_USER,
 						(reas->yes & REAS_YES_UR ? STR_READ : ""),
 						(reas->yes & REAS_YES_UW ? STR_WRIT : ""),
@@ -742,7 +799,7 @@ static void report(reason_t *reas, user_t *user)
 				}
 				/* print "group" perms that helped us */
 				if (REAS_NONE != (reas->yes & (REAS_YES_GR | REAS_YES_GW | REAS_YES_GX))) {
-					printf("%s%s+%s%s%s",
+					fprintf(Report_Out, "%s%s+%s%s%s",
 						(1 == comma ? "," : ""),
 						STR_GROUP,
 						(reas->yes & REAS_YES_GR ? STR_READ : ""),
@@ -753,7 +810,7 @@ static void report(reason_t *reas, user_t *user)
 				}
 				/* print "other" perms that helped us */
 				if (REAS_NONE != (reas->yes & (REAS_YES_OR | REAS_YES_OW | REAS_YES_OX))) {
-					printf("%s%s+%s%s%s",
+					fprintf(Report_Out, "%s%s+%s%s%s",
 						(1 == comma ? "," : ""),
 						STR_OTH,
 						(reas->yes & REAS_YES_OR ? STR_READ : ""),
@@ -762,36 +819,27 @@ static void report(reason_t *reas, user_t *user)
 					);
 				}
 				if ((REAS_YES_OWNER & reas->yes)) {
-					printf("%s%s",
+					fprintf(Report_Out, "%s%s",
 						(1 == comma ? "," : ""),
 						STR_OWNER
 					);
 				} else if ((REAS_YES_ROOT & reas->yes)) { /* can't have both */
-					printf("%s%s",
+					fprintf(Report_Out, "%s%s",
 						(1 == comma ? "," : ""),
 						STR_ROOT
 					);
 				}
 			} /* if reas->yes */
-			printf(")");
+			fprintf(Report_Out, ")");
 			/* print mntpt data if path is mntpt */
 			if (path_is_mntpt(path)) {
-				printf(" (mnt %s)", mntpt->mntdev);
+				fprintf(Report_Out, " (mnt %s)", mntpt->mntdev);
 			}
 
 			/* if group perms helped, list which group */
 			if (REAS_NONE != (reas->yes & (REAS_YES_GR | REAS_YES_GW | REAS_YES_GX))) {
-				list_node *node;
-				group_t *g;
-				char *s = NULL;
-				for (node = list_first(user->groups); node != NULL; node = list_node_next(node)) {
-					g = list_node_data(node);
-					if (g->gid == path->gid) {
-						s = g->name;
-						break;
-					}
-				}
-				printf(" (group %s)", (NULL == s ? "?" : s));
+				struct group *g = getgrgid(path->gid); /* only groups we're in get here */
+				fprintf(Report_Out, " (group %s)", (NULL == g || NULL == g->gr_name ? "?" : g->gr_name));
 			}
 
 			if (REAS_NONE != reas->no) { /* print reasons why we didn't succeed */
@@ -800,7 +848,7 @@ static void report(reason_t *reas, user_t *user)
 				/* iterate through all possible error messages and print any that match */
 				for (c = 1, comma = 0, i = 1; c < 32; c++, i <<= 1) {
 					if (0 != (reas->no & i)) {
-						printf("%s%s",
+						fprintf(Report_Out, "%s%s",
 							(1 == comma ? ", " : " "),
 							RPT_REASONS[c]
 						);
@@ -813,18 +861,21 @@ static void report(reason_t *reas, user_t *user)
 #ifdef DEBUG
 	printf(" (yes:%d, no:%d)", reas->yes, reas->no);
 #endif
-	printf("\n");
+	fprintf(Report_Out, "\n");
 }
 
-static void perm_calc(const char *username, const char *path, permdsc_t *perms)
+/* returns 1 if user has perms on path, 0 if not, -1 if path could not be read */
+/* if deps isn't NULL, the abspath of everything the answer came from goes in it */
+static int perm_calc(session_t *sess, user_t *user, const char *path, permdsc_t *perms, vec_t *deps)
 {
-	list_head *target = NULL, *paths = NULL;
-	user_t *user = NULL;
-	char *cwd = NULL;
+	pathtok_t target;
+	pathvec_small_t paths;
+	query_t q;
 	int able = 0;
 
 #ifdef DEBUG
-	assert(NULL != username);
+	assert(NULL != sess);
+	assert(NULL != user);
 	assert(NULL != path);
 	assert(NULL != perms);
 #endif
@@ -836,50 +887,252 @@ static void perm_calc(const char *username, const char *path, permdsc_t *perms)
 	Verbose(2, ADD_APPEND, "VB checking file '%s'...\n", path);
 #endif
 
-	cwd = xmalloc(PATH_MAX);
-	cwd = getcwd(cwd, PATH_MAX);
+	/* mounts may have come or gone since the last path */
+	session_sync(sess);
 
 	/* split up our target, if path is invalid, program dies here */
-	target = path_calc_target(path, cwd);
-
-	user = user_load(username);
-
-#ifdef DEBUG
-	user_dump(user);
-#endif
-
-	/* load mntpt data into global var */
-	MNTPTS = mnt_load();
-
-#ifdef DEBUG
-	list_dump(MNTPTS, mntpt_dump);
-#endif
+	pathtok_init(&target);
+	path_calc_target(&target, path, sess->cwd);
 
 	/* read all path information */
 	/* FIXME: target is getting corrupted somehow... looks ok in the function, */
 	/* but what i get back is junk */
-	paths = path_split(&target, FOLLOW);
+	pathvec_init_small(&paths);
+	if (-1 == path_split(&paths.pv, &target, FOLLOW)) {
+		int save_err = errno;
+		perm_deps(&paths.pv, deps);
+		pathvec_destroy(&paths.pv);
+		pathtok_destroy(&target);
+		/* in batch mode a bad path is just another answer */
+		if (!Flag_Batch)
+			fatal_invalid_path(__FILE__, __LINE__, path, save_err);
+		fprintf(Report_Out, "ERR file '%s' %s\n", path, strerror(save_err));
+		return -1;
+	}
 #ifdef DEBUG
 	printf("perm_calc:%d target: ", __LINE__);
-	list_dump(target, list_dump_cb_chars);
+	path_target_dump(&target);
 #endif
 
 #ifdef DEBUG
 	printf("perm_calc:%d ", __LINE__);
-	list_dump(paths, path_dump);
+	pathvec_dump(&paths.pv);
 	exit(EXIT_SUCCESS);
 #endif
 
 	/* generate a report, figure out if we actually have perms */
-	able = report_gen(paths, user, perms, OUTPUT_ALL);
+	query_init(&q, perms);
+	able = report_gen(&paths.pv, user, &q, OUTPUT_ALL);
+
+	perm_deps(&paths.pv, deps);
+	pathvec_destroy(&paths.pv);
+	pathtok_destroy(&target);
+
+	return able;
+}
+
+/* put the abspath of every entry in paths into deps, if there is a deps */
+static void perm_deps(pathvec_t *paths, vec_t *deps)
+{
+	const char *abspath;
+	size_t i;
+
+	if (NULL == deps)
+		return;
+	for (i = 0; i < pathvec_len(paths); i++) {
+		abspath = path_chain_abspath(paths, i);
+		(void)strtab_add(deps, abspath, strlen(abspath));
+	}
+}
+
+/* answer "user perms path" records read from stdin, one result line per record */
+/* delim separates records: '\n' or '\0' */
+static void batch_run(session_t *sess, permdsc_t *defperms, int delim)
+{
+	permdsc_t *perms;
+	char *line = NULL;
+	size_t linecap = 0;
+	ssize_t len;
+
+#ifdef DEBUG
+	assert(NULL != sess);
+	assert(NULL != defperms);
+#endif
+
+	perms = permdsc_alloc();
+
+	while (-1 != (len = getdelim(&line, &linecap, delim, stdin))) {
+		if (len > 0 && delim == line[len - 1])
+			line[--len] = '\0';
+		(void)batch_record(sess, defperms, perms, line, delim, NULL);
+	}
+
+	xfree(line);
+	permdsc_free(perms);
+}
+
+/* answer one "user perms path" record, its delim already gone */
+/* perms is scratch space for the record's perms, deps is perm_calc()'s */
+/* returns what perm_calc() did, or -1 if the record was no good */
+static int batch_record(session_t *sess, permdsc_t *defperms, permdsc_t *perms, char *line, int delim, vec_t *deps)
+{
+	char *who, *rawperms, *path;
+	user_t *user;
+	size_t len = strlen(line);
+
+	if ('\n' == delim && len > 0 && '\r' == line[len - 1])
+		line[--len] = '\0';
+
+	/* fields are "user perms path", path is everything after the 2nd field */
+	who = line + strspn(line, " \t");
+	if ('\0' == *who) { /* still gets its line, answers go by position */
+		fprintf(Report_Out, "ERR empty record\n");
+		return -1;
+	}
+	rawperms = who + strcspn(who, " \t");
+	if ('\0' != *rawperms)
+		*rawperms++ = '\0';
+	rawperms += strspn(rawperms, " \t");
+	path = rawperms + strcspn(rawperms, " \t");
+	if ('\0' != *path)
+		*path++ = '\0';
+	path += strspn(path, " \t");
+
+	if ('\0' == *rawperms || '\0' == *path) {
+		fprintf(Report_Out, "ERR malformed record '%s'\n", who);
+		return -1;
+	}
+
+	if (0 == strcmp(who, "-")) {
+		user = sess->user;
+	} else if (NULL == (user = session_user(sess, who))) {
+		fprintf(Report_Out, "ERR %s '%s' does not exist\n",
+			(strisnum(who) ? "uid" : "username"), who);
+		return -1;
+	}
+
+	if (0 == strcmp(rawperms, "-"))
+		permdsc_set_mask(perms, defperms->mask);
+	else
+		permdsc_set_mask(perms, decode_perms(rawperms));
+
+	return perm_calc(sess, user, path, perms, deps);
+}
+
+/* serve_run() callback, answers a record from a client the way --batch would */
+static void serve_answer(char *record, FILE *out, void *v)
+{
+	serve_ctx_t *ctx = v;
+	Report_Out = out;
+	(void)batch_record(ctx->sess, ctx->defperms, ctx->perms, record, ctx->delim, NULL);
+	Report_Out = stdout;
+}
+
+/* record's answer as batch_record() would print it, the paths it came */
+/* from go in deps. record is left alone, it gets answered again later */
+static char *watch_answer(session_t *sess, permdsc_t *defperms, permdsc_t *perms,
+	const char *record, int delim, vec_t *deps)
+{
+	char *line, *buf = NULL;
+	size_t len = 0;
+
+	line = strdup(record);
+	if (NULL == line || NULL == (Report_Out = open_memstream(&buf, &len)))
+		err_bail(__FILE__, __LINE__, "could not set up an answer");
+	vec_clear(deps);
+	(void)batch_record(sess, defperms, perms, line, delim, deps);
+	if (0 != fclose(Report_Out))
+		err_bail(__FILE__, __LINE__, "could not close answer buffer");
+	Report_Out = stdout;
+	free(line);
+	return buf; /* open_memstream()'s, free() it */
+}
+
+/* answer record id and watch the paths it came from. the watches only go */
+/* up once it's answered, and a change in between would never be heard of, */
+/* so it's answered again until it comes out the same from the same paths */
+static char *watch_settle(session_t *sess, permdsc_t *defperms, permdsc_t *perms, watch_t *w,
+	size_t id, const char *record, int delim, vec_t *deps, vec_t *prev)
+{
+	char *ans, *again;
+	int tries, same = 0;
+
+	ans = watch_answer(sess, defperms, perms, record, delim, deps);
+	for (tries = 0; !same && tries < WATCH_SETTLE; tries++) {
+		watch_set(w, id, deps);
+		vec_clear(prev);
+		vec_append(prev, deps);
+		again = watch_answer(sess, defperms, perms, record, delim, deps);
+		same = (0 == strcmp(ans, again) && vec_len(prev) == vec_len(deps)
+			&& 0 == memcmp(vec_ptr(prev, char, 0), vec_ptr(deps, char, 0), vec_len(deps)));
+		free(ans);
+		ans = again;
+	}
+	if (!same) /* still moving, at least watch where it is now */
+		watch_set(w, id, deps);
+	return ans;
+}
 
-	list_free(paths, path_free);
-	list_free(target, NULL);
+/* answer "user perms path" records read from stdin like batch_run(), then */
+/* stay up and answer each one again when a path it came from changes. a */
+/* record's result line is printed again only if it comes out different, */
+/* after its id so it can be told which record it is */
+static void watch_run(session_t *sess, permdsc_t *defperms, int delim)
+{
+	watch_t *w;
+	permdsc_t *perms;
+	vec_t recs; /* char *, records as read, a record's id is its index */
+	vec_t answers; /* char *, each record's last answer */
+	vec_t deps, prev, ids;
+	char *line = NULL, *ans;
+	size_t linecap = 0, i, id;
+	ssize_t len;
+
+#ifdef DEBUG
+	assert(NULL != sess);
+	assert(NULL != defperms);
+#endif
 
-	list_free(MNTPTS, mntpt_free);
-	user_free(user);
-	xfree(cwd);
+	perms = permdsc_alloc();
+	w = watch_alloc();
+	vec_init(&recs, sizeof(char *), NULL, 0);
+	vec_init(&answers, sizeof(char *), NULL, 0);
+	vec_init(&deps, 1, NULL, 0);
+	vec_init(&prev, 1, NULL, 0);
+	vec_init(&ids, sizeof(size_t), NULL, 0);
+
+	while (-1 != (len = getdelim(&line, &linecap, delim, stdin))) {
+		if (len > 0 && delim == line[len - 1])
+			line[--len] = '\0';
+		if (NULL == (*(char **)vec_push(&recs, NULL) = strdup(line)))
+			err_bail(__FILE__, __LINE__, "could not save record");
+	}
+	xfree(line);
 
+	for (id = 0; id < vec_len(&recs); id++) {
+		ans = watch_settle(sess, defperms, perms, w, id, vec_at(&recs, char *, id), delim, &deps, &prev);
+		printf("%lu %s", (unsigned long)id, ans);
+		*(char **)vec_push(&answers, NULL) = ans;
+	}
+	fflush(stdout);
+
+	/* nothing to do until something changes, then only for what it touches */
+	for (;;) {
+		watch_wait(w, &ids);
+		for (i = 0; i < vec_len(&ids); i++) {
+			id = vec_at(&ids, size_t, i);
+			/* a symlink may lead somewhere else now */
+			ans = watch_settle(sess, defperms, perms, w, id, vec_at(&recs, char *, id), delim, &deps, &prev);
+			if (0 != strcmp(ans, vec_at(&answers, char *, id))) {
+				printf("%lu %s", (unsigned long)id, ans);
+				free(vec_at(&answers, char *, id));
+				vec_at(&answers, char *, id) = ans;
+			} else {
+				free(ans);
+			}
+		}
+		fflush(stdout);
+	}
 }
 
 static void verbose_add(const char *msg, int whichend)
@@ -910,6 +1163,7 @@ static void verbose_flush(void)
 
 static void init_globals(void)
 {
+	Report_Out = stdout;
 	if (NULL == VERBOSE_MSG)
 		if (NULL == (VERBOSE_MSG = list_head_create()))
 			err_bail(__FILE__, __LINE__, "could not create VERBOSE_MSG");
@@ -918,6 +1172,7 @@ static void init_globals(void)
 static void cleanup_globals(void)
 {
 	list_free(VERBOSE_MSG, NULL); /* destroy list */
+	bstat_free(Dele_Stat);
 }
 
 /* parses options, launches */
@@ -926,7 +1181,15 @@ int main(int argc, char **argv)
 
 	char *username = NULL, *rawperms = NULL;
 	permdsc_t *perms = NULL;
-	int opt;
+	session_t *sess = NULL;
+	int opt, delim = '\n';
+	const struct option long_opts[] = {
+		{ "batch",	no_argument,	NULL,	'b' },
+		{ "serve",	required_argument,	NULL,	'S' },
+		{ "watch",	no_argument,	NULL,	'W' },
+		{ "help",	no_argument,	NULL,	'h' },
+		{ NULL,		0,				NULL,	0 }
+	};
 
 #ifdef DEBUG
 	test_stuff();
@@ -943,7 +1206,7 @@ int main(int argc, char **argv)
 	/* parse options */
 	opterr = 0;
 
-	while ((opt = getopt(argc, argv, "u:p:vh")) != -1) {
+	while ((opt = getopt_long(argc, argv, "u:p:vhb0j:", long_opts, NULL)) != -1) {
 #ifdef DEBUG
 		printf("main:%d optind: %d, opterr: %d, opt: \'%c\', optarg: \"%s\"\n",
 			__LINE__, optind, opterr, opt, optarg);
@@ -966,6 +1229,26 @@ int main(int argc, char **argv)
 			/* allow multiple perm args */
 			rawperms = strapp(rawperms, optarg);
 			break;
+		case 'b': /* batch */
+			Flag_Batch = 1;
+			break;
+		case 'S': /* serve, long form only */
+			if (NULL != Flag_Serve)
+				fatal("you may only serve on one socket");
+			Flag_Serve = strdup(optarg);
+			Flag_Batch = 1; /* a bad path is just another answer there too */
+			break;
+		case 'W': /* watch, long form only */
+			Flag_Watch = 1;
+			Flag_Batch = 1; /* records come the way they do for --batch */
+			break;
+		case '0': /* NUL-delimited batch records */
+			delim = '\0';
+			break;
+		case 'j': /* jobs */
+			if (NULL == optarg || !strisnum(optarg) || (Flag_Jobs = atoi(optarg)) < 1)
+				fatal("jobs must be a number of threads");
+			break;
 		case 'v': /* verbose */
 			if (Flag_Verbose < VERBOSE_MAX)
 				++Flag_Verbose;
@@ -1018,11 +1301,14 @@ int main(int argc, char **argv)
 
 	/* getopt reorders argv and sets optind to the first args pass that it didn't process */
 
-	if (optind == argc) { /* no files left */
+	if ((optind == argc) == !Flag_Batch) { /* no files left, or files and batch */
 		printf(USAGE);
 		exit(EXIT_FAILURE);
 	}
 
+	if (Flag_Watch && NULL != Flag_Serve)
+		fatal("you may only --watch or --serve, not both");
+
 	/* fill in default args if they weren't set */
 	/* no user, use default */
 	if (NULL == username) {
@@ -1030,6 +1316,9 @@ int main(int argc, char **argv)
 		Verbose(2, ADD_APPEND, "VB using default user '%s'...\n", username);
 	}
 		
+	if (0 == Flag_Jobs)
+		Flag_Jobs = pscan_jobs_default();
+
 	/* no perms, use default */
 	if (NULL == rawperms) {
 		perm_t mask = decode_perms(DEFAULT_PERMS); /* get canonical perms */
@@ -1053,16 +1342,37 @@ int main(int argc, char **argv)
 			printf("main:%d argv[%p]: \"%s\"\n", __LINE__, (void *)tmp, *tmp);
 #endif
 
+		/* load user, groups and mount info once, shared by every path */
+		sess = session_open(username, Flag_Batch);
+
 		/* calc perms on all paths sent to us */
-		/* FIXME: the loop should be inside perm_calc so we can load user, mount info once */
-		for (tmp = argv + optind; *tmp != NULL; tmp++)
-			perm_calc(username, *tmp, perms);
+		if (NULL != Flag_Serve) {
+			serve_ctx_t ctx;
+			ctx.sess = sess;
+			ctx.defperms = perms;
+			ctx.perms = permdsc_alloc();
+			ctx.delim = delim;
+			Verbose(1, ADD_APPEND, "VB serving on '%s'...\n", Flag_Serve);
+			verbose_flush();
+			(void)serve_run(Flag_Serve, delim, serve_answer, &ctx);
+			permdsc_free(ctx.perms);
+		} else if (Flag_Watch) {
+			watch_run(sess, perms, delim);
+		} else if (Flag_Batch) {
+			batch_run(sess, perms, delim);
+		} else {
+			for (tmp = argv + optind; *tmp != NULL; tmp++)
+				(void)perm_calc(sess, sess->user, *tmp, perms, NULL);
+		}
+
+		session_close(sess);
 
 	}
 
 	/* clean up */
 	xfree(rawperms);
 	xfree(username);
+	xfree(Flag_Serve);
 	permdsc_free(perms);
 
 	cleanup_globals();
@@ -1087,7 +1397,7 @@ static void test_stuff(void)
 
 static void test_path_calc_target()
 {
-	list_head *list;
+	pathtok_t tok;
 	const char **curr;
 	int i;
 	char cwd[PATH_MAX];
@@ -1102,19 +1412,18 @@ static void test_path_calc_target()
 		,NULL
 	};
 
-	assert(NULL != (list = list_head_create()));
-
 	printf("testing path_calc_target...\n");
 
 	(void)getcwd(cwd, sizeof cwd);
 
+	pathtok_init(&tok);
 	for (i = 0, curr = paths; NULL != curr; i++, curr++) {
 		printf("iteration %d: \"%s\":\n", i, *curr);
-		list = path_calc_target(*curr, cwd);
-		list_dump(list, list_dump_cb_chars);
+		path_calc_target(&tok, *curr, cwd);
+		path_target_dump(&tok);
 		printf("\n===============\n");
-		list_nodes_free(list, NULL);
 	}
+	pathtok_destroy(&tok);
 
 	printf("\ndone.\n");
 }
@@ -1148,10 +1457,13 @@ static void test_path_split(void)
 
 static void test_mnt_load(void)
 {
-	list_head *mnts = NULL;
+	mntlist_t *mnts = NULL;
+	mntpt_t *mnt;
 	mnts = mnt_load();
 	printf("mnt_load dump:\n");
-	list_dump(mnts, mntpt_dump);
+	for (mnt = vec_first(&mnts->mnts, mntpt_t); mnt < vec_end(&mnts->mnts, mntpt_t); mnt++)
+		mntpt_dump(mnt);
+	mnt_unload(mnts);
 }
 
 
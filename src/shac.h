@@ -9,6 +9,10 @@
 
 #include <unistd.h>
 #include "llist.h"
+#include "vec.h"
+#include "lnkcache.h"
+#include "bstat.h"
+#include "statcache.h"
 #ifdef LINUX
 	#include <mntent.h> /* glibc-ish: setgrent(), getgrent() endgrent(), etc. */
 #else
@@ -18,6 +22,7 @@
 #include <pwd.h> /* struct passwd, getpwnam */
 #include <grp.h> /* struct group, setgrent, getgrent, endgrent */
 #include <sys/stat.h> /* struct stat, stat */
+#include <pthread.h> /* pthread_mutex_t */
 
 
 #if 0
@@ -133,59 +138,186 @@ typedef unsigned perm_t;
 typedef struct {
 	char *mntdir;
 	char *mntdev;
-	perm_t perms;
+	char *root; /* what part of mntdev's fs shows up at mntdir, "/" for all of it */
+	int id, parent; /* mount IDs from the kernel, -1 if it didn't give us any */
+	dev_t dev; /* st_dev of what's on it, 0 if we don't know */
+	unsigned flags; /* MNTPT_* */
+	perm_t perms; /* what flags leave anybody able to do */
+	unsigned seq; /* mount order, later ones cover earlier ones */
 } mntpt_t;
 
-#define mntpt_is_readonly(mnt) (PERM_NONE != (mnt->perms & PERM_WRIT))
+#define MNTPT_RO		1
+#define MNTPT_NOEXEC	2
+#define MNTPT_NOSUID	4
+#define MNTPT_NODEV		8
+
+/* what mnt_load() read, every mount's strings are somewhere in strs */
+typedef struct {
+	vec_t mnts; /* mntpt_t, in mount order */
+	vec_t strs; /* chars */
+} mntlist_t;
+
+/* index over a list of mntpt_t, see mnt.c */
+typedef struct mnttrie mnttrie_t;
+typedef struct mntdev mntdev_t;
+typedef struct {
+	vec_t *mnts; /* every mntpt_t, in mount order */
+	mnttrie_t *root; /* "/", mntdir components hang off it */
+	mnttrie_t **buckets; /* children, hashed on parent and name */
+	size_t nbuckets;
+	mntdev_t *devs; /* visible mounts by st_dev, filled in on first use */
+	size_t ndevs;
+	int devs_ready;
+	pthread_mutex_t devs_lock;
+	mntpt_t **ids; /* mounts by id, open addressing, NULL where there's none */
+	size_t nids;
+} mnttab_t;
+
+/* a walk down the mount trie, one path component at a time */
+typedef struct {
+	const mnttrie_t *node; /* NULL once there are no mounts further down */
+	mntpt_t *mnt; /* mount the walk is on so far */
+} mntcur_t;
+
+#define mntpt_is_readonly(mnt) (PERM_NONE == (mnt->perms & PERM_WRIT))
 
 typedef struct {
 	char *name;
 	char is_user;
 	uid_t uid;
 	gid_t gid; /* primary group */
-	list_head * groups; /* all users group, including primary */
+	gid_t *groups; /* all users groups, including primary, sorted */
+	size_t ngroups;
+	gid_t *groupset; /* groups again, hashed for user_in_group() */
+	size_t groupset_mask; /* size - 1, size is a power of 2 */
 } user_t;
 
-typedef struct {
-	gid_t gid;
-	char *name;
-} group_t;
-
 /**
- *
+ * what report_calc() needs to know about one file, kept small so the
+ * checks run over packed records. names live apart, see pathname_t
  */
 typedef struct {
-	char *abspath;
-	char *dir;
-	char *component;
-	char *symlink; /* path this file points to if it's a symlink */
+	mode_t mode; /* file info and perm bits */
 	uid_t uid;
 	gid_t gid;
-	perm_t status; /* could we access this file? why or why not? */
-	mode_t mode; /* file info and perm bits */
+	unsigned short status; /* could we access this file? why or why not? */
+	unsigned short flags; /* PATH_* */
 	mntpt_t *mntpt; /* mnt data or NULL if none */
 } path_t;
 
-#define path_is_symlink(path)	((NULL != path->symlink ? 1 : 0))
+#define PATH_SYMLINK	1 /* a symlink we followed, its target is in pathname_t */
+#define PATH_MNTPT		2 /* mntpt is mounted right here */
+
+/* where a path_t's names are in the string table of the pathvec_t it's in */
+typedef struct {
+	stroff_t abspath; /* STROFF_NONE until someone needs it, see path_chain_abspath() */
+	stroff_t component;
+	stroff_t symlink; /* path this file points to if it's a symlink */
+} pathname_t;
+
+/* path_ts and their names side by side, names[i] goes with paths[i] */
+typedef struct {
+	vec_t paths; /* path_t */
+	vec_t names; /* pathname_t */
+	vec_t strs; /* string table names point into */
+} pathvec_t;
+
+/* a pathvec_t with room for the components of most paths, so they never malloc() */
+#define PATHVEC_INLINE	16
+typedef struct {
+	pathvec_t pv; /* use this, don't copy the struct */
+	path_t paths[PATHVEC_INLINE];
+	pathname_t names[PATHVEC_INLINE];
+	char strs[PATHVEC_INLINE * 32];
+} pathvec_small_t;
+
+/*
+	a path cut into components without copying them: the whole path sits in
+	one buffer with every separator overwritten by '\0', and each component
+	is an offset and length into it. ".." just drops the last component.
+	the first component is always "/"
+*/
+typedef struct {
+	uint32_t off, len;
+} pathtok_comp_t;
+
+#define PATHTOK_INLINE	256 /* chars of path before it malloc()s */
+typedef struct {
+	vec_t buf; /* chars */
+	vec_t comps; /* pathtok_comp_t */
+	char bufinl[PATHTOK_INLINE]; /* don't copy the struct */
+	pathtok_comp_t compsinl[PATHVEC_INLINE * 2];
+} pathtok_t;
+
+#define pathtok_len(t)			vec_len(&(t)->comps)
+#define pathtok_str(t, i)		strtab_at(&(t)->buf, vec_at(&(t)->comps, pathtok_comp_t, i).off)
+#define pathtok_strlen(t, i)	((size_t)vec_at(&(t)->comps, pathtok_comp_t, i).len)
+
+#define pathvec_len(pv)			vec_len(&(pv)->paths)
+#define pathvec_path(pv, i)		vec_ptr(&(pv)->paths, path_t, i)
+#define pathvec_last(pv)		vec_last(&(pv)->paths, path_t)
+#define pathvec_name(pv, i)		vec_ptr(&(pv)->names, pathname_t, i)
+#define pathvec_str(pv, off)	strtab_str(&(pv)->strs, off)
+#define pathvec_at(pv, off)		strtab_at(&(pv)->strs, off)
+#define pathvec_abspath(pv, i)	pathvec_str(pv, pathvec_name(pv, i)->abspath)
+#define pathvec_component(pv, i)	pathvec_str(pv, pathvec_name(pv, i)->component)
+
+#define path_is_symlink(path)	(((path->flags & PATH_SYMLINK) ? 1 : 0))
 #define path_is_dir(path)		((S_ISDIR(path->mode) ? 1 : 0))
 #define path_is_file(path)		((S_ISREG(path->mode) ? 1 : 0))
 #define path_is_sticky(path)	(((S_ISVTX & path->mode) ? 1 : 0))
-#define path_is_mntpt(path)		(((NULL != path->mntpt && 0 == strcmp(path->abspath, path->mntpt->mntdir)) ? 1 : 0))
+#define path_is_mntpt(path)		(((path->flags & PATH_MNTPT) ? 1 : 0))
 #define path_status_not_ok(path) ((STATUS_OK != path->status))
 
 /* represents information necessary to generate a line of a report */
 typedef struct {
 	path_t *path;
+	pathname_t name; /* path's names, in the pathvec_t it came from */
 	int label; /* FIXME: enum rpt ? */
 	perm_t yes; /* reasons why */
 	perm_t no; /* reasons why not */
 } reason_t;
 
+/* a name or uid session_user() has resolved, as it was asked for */
+typedef struct {
+	stroff_t who; /* in userstrs, STROFF_NONE if the slot is free */
+	user_t *user;
+} userkey_t;
+
+/* state shared by every path checked in one invocation */
+typedef struct {
+	user_t *user; /* default user we're checking on, groups loaded */
+	list_head *users; /* every user resolved so far, including the default */
+	vec_t userkeys; /* userkey_t, open addressing, power of 2 of them */
+	vec_t userstrs; /* chars, what userkeys were asked for */
+	size_t nuserkeys; /* slots used */
+	mntlist_t *mntlist; /* mount points */
+	mnttab_t *mnttab; /* index over them */
+	int mntfd; /* says when mnttab is out of date, -1 unless we stay up */
+	lnkcache_t *lnkcache; /* symlinks already read */
+	bstat_t *prefstat; /* lstat()s path_split() gets ahead of itself with */
+	statcache_t *statcache; /* lstat()s path_split() has done, NULL unless we stay up */
+	char *cwd; /* relative paths are resolved against this */
+} session_t;
+
 /* holds permissions in human and machine readable format */
 typedef struct {
 	char *dsc;
 	perm_t mask;
 } permdsc_t;
 
+/*
+	how each entry of one query gets judged, worked out once from the perms
+	asked for, so report_calc() doesn't sort that out again per entry
+*/
+typedef struct query query_t;
+struct query {
+	permdsc_t *permreq; /* what was asked for */
+	perm_t permeff; /* what it takes, see perm_effective() */
+	perm_t start[2][2]; /* reas->no to start from, by [last entry?][dir?] */
+	/* checks only the last entry gets, NULL if none. same return as report_calc() */
+	int (*last)(reason_t *, const path_t *, const user_t *, perm_t);
+};
+
 
 #endif
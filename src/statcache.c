@@ -0,0 +1,494 @@
+/* ex: set ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h> /* clock_gettime */
+#ifdef DEBUG
+#include <assert.h>
+#endif
+#include "statcache.h"
+#include "util.h"
+
+#if defined(__linux__)
+#define STATCACHE_INOTIFY
+#include <sys/inotify.h>
+#include <sys/vfs.h> /* statfs */
+#endif
+
+#define STATCACHE_TTL_NSEC	1000000000LL /* how long an entry nobody's watching stands */
+#define STATCACHE_MIN		64 /* buckets per shard to start with */
+#define STATCACHE_MAX		(1 << 14) /* entries per shard, past that the shard starts over */
+#define STATCACHE_WATCHES	8192 /* dirs we watch at most, the rest get a TTL */
+
+#define statcache_shard(c, hash)	(&(c)->shards[(hash) % STATCACHE_SHARDS])
+#define statcache_bucket(s, hash)	(&(s)->buckets[((hash) / STATCACHE_SHARDS) & (s)->mask])
+
+struct statcache_ent {
+	statcache_ent_t *next;
+	size_t hash;
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec ctim;
+	long long expires; /* 0 if a watch will tell us when it changes */
+	int wd; /* watch on this dir, -1 if what's in it gets a TTL */
+	char path[];
+};
+
+struct statcache_watch {
+	statcache_watch_t *next;
+	int wd;
+	char path[];
+};
+
+static size_t statcache_hash(const char *);
+static long long statcache_now(void);
+static void statcache_reset(statcache_shard_t *, size_t);
+static statcache_ent_t **statcache_find(statcache_shard_t *, const char *, size_t);
+static int statcache_parent(statcache_t *, const char *, int *);
+static void statcache_drop(statcache_t *, const char *);
+static int statcache_watch(statcache_t *, const char *, const struct stat *);
+static statcache_watch_t *statcache_watch_find(const statcache_t *, int);
+static void statcache_unwatch(statcache_t *);
+
+static size_t statcache_hash(const char *path)
+{
+	unsigned long long h = 0xcbf29ce484222325ULL; /* fnv-1a */
+	while ('\0' != *path)
+		h = (h ^ (unsigned char)*path++) * 0x100000001b3ULL;
+	return (size_t)(h ^ (h >> 32));
+}
+
+/* monotonic clock in nanoseconds, coarse is plenty for a TTL */
+static long long statcache_now(void)
+{
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+statcache_t *statcache_alloc(void)
+{
+	statcache_t *c = xmalloc(sizeof *c);
+	size_t i;
+	for (i = 0; i < STATCACHE_SHARDS; i++) {
+		statcache_shard_t *s = &c->shards[i];
+		pthread_mutex_init(&s->lock, NULL);
+		s->buckets = NULL;
+		s->used = 0;
+		statcache_reset(s, STATCACHE_MIN);
+	}
+#ifdef STATCACHE_INOTIFY
+	c->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC); /* -1 just means TTLs all round */
+#else
+	c->ifd = -1;
+#endif
+	pthread_mutex_init(&c->watch_lock, NULL);
+	c->watch_mask = STATCACHE_MIN - 1;
+	c->watches = xmalloc((c->watch_mask + 1) * sizeof *c->watches);
+	memset(c->watches, 0, (c->watch_mask + 1) * sizeof *c->watches);
+	c->nwatches = 0;
+	return c;
+}
+
+/* empty s out, with room for nbuckets. caller holds s->lock */
+static void statcache_reset(statcache_shard_t *s, size_t nbuckets)
+{
+	statcache_ent_t *e, *next;
+	size_t i;
+	if (NULL != s->buckets) {
+		for (i = 0; i <= s->mask; i++)
+			for (e = s->buckets[i]; NULL != e; e = next) {
+				next = e->next;
+				xfree(e);
+			}
+		xfree(s->buckets);
+	}
+	s->buckets = xmalloc(nbuckets * sizeof *s->buckets);
+	memset(s->buckets, 0, nbuckets * sizeof *s->buckets);
+	s->mask = nbuckets - 1;
+	s->used = 0;
+}
+
+/* the link to path's entry in s, or the NULL at the end of its chain */
+/* caller holds s->lock */
+static statcache_ent_t **statcache_find(statcache_shard_t *s, const char *path, size_t hash)
+{
+	statcache_ent_t **link;
+	for (link = statcache_bucket(s, hash); NULL != *link; link = &(*link)->next)
+		if ((*link)->hash == hash && 0 == strcmp((*link)->path, path))
+			break;
+	return link;
+}
+
+/* fill in st from path's entry, the fields path_split() needs and no others */
+/* returns 0, or -1 if we don't have it or it's gone stale */
+int statcache_get(statcache_t *c, const char *path, struct stat *st)
+{
+	size_t hash;
+	statcache_shard_t *s;
+	statcache_ent_t **link, *e;
+#ifdef DEBUG
+	assert(NULL != c);
+	assert(NULL != path);
+	assert(NULL != st);
+#endif
+
+	hash = statcache_hash(path);
+	s = statcache_shard(c, hash);
+	pthread_mutex_lock(&s->lock);
+	link = statcache_find(s, path, hash);
+	if (NULL == (e = *link)) {
+		pthread_mutex_unlock(&s->lock);
+		return -1;
+	}
+	if (0 != e->expires && statcache_now() > e->expires) {
+		*link = e->next;
+		s->used--;
+		pthread_mutex_unlock(&s->lock);
+		xfree(e);
+		return -1;
+	}
+	st->st_mode = e->mode;
+	st->st_uid = e->uid;
+	st->st_gid = e->gid;
+	st->st_dev = e->dev;
+	st->st_ino = e->ino;
+	st->st_size = e->size;
+	st->st_ctim = e->ctim;
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+}
+
+/* whether parent is cached, and if so the watch on it in *wd */
+static int statcache_parent(statcache_t *c, const char *parent, int *wd)
+{
+	size_t hash = statcache_hash(parent);
+	statcache_shard_t *s = statcache_shard(c, hash);
+	statcache_ent_t *e;
+	int found = 0;
+	pthread_mutex_lock(&s->lock);
+	if (NULL != (e = *statcache_find(s, parent, hash))
+		&& (0 == e->expires || statcache_now() <= e->expires)) {
+		*wd = e->wd;
+		found = 1;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return found;
+}
+
+/* remember st as the lstat() of path, which is in dir parent ("/" has none) */
+/* a name only goes in once its dir has, so the dir's watch covers it */
+void statcache_put(statcache_t *c, const char *path, const char *parent, const struct stat *st)
+{
+	size_t hash, len;
+	statcache_shard_t *s;
+	statcache_ent_t **link, *e;
+	long long expires = 0;
+	int wd = -1, pwd = -1;
+#ifdef DEBUG
+	assert(NULL != c);
+	assert(NULL != path);
+	assert(NULL != st);
+#endif
+
+	/* a chmod through another link only touches that link's dir, we'd never hear of it */
+	if (!S_ISDIR(st->st_mode) && st->st_nlink > 1)
+		return;
+	if (NULL != parent) {
+		if (!statcache_parent(c, parent, &pwd))
+			return;
+		if (-1 == pwd) /* nobody will tell us if it changes */
+			expires = statcache_now() + STATCACHE_TTL_NSEC;
+	}
+	if (S_ISDIR(st->st_mode) && -1 == (wd = statcache_watch(c, path, st)))
+		expires = statcache_now() + STATCACHE_TTL_NSEC;
+
+	len = strlen(path);
+	e = xmalloc(sizeof *e + len + 1);
+	e->mode = st->st_mode;
+	e->uid = st->st_uid;
+	e->gid = st->st_gid;
+	e->dev = st->st_dev;
+	e->ino = st->st_ino;
+	e->size = st->st_size;
+	e->ctim = st->st_ctim;
+	e->expires = expires;
+	e->wd = wd;
+	memcpy(e->path, path, len + 1);
+	e->hash = hash = statcache_hash(path);
+
+	s = statcache_shard(c, hash);
+	pthread_mutex_lock(&s->lock);
+	if (s->used >= STATCACHE_MAX) { /* a batch that never repeats itself, don't hoard */
+		statcache_reset(s, s->mask + 1);
+	} else if (s->used + 1 > s->mask + 1) { /* keep chains short, move everything over */
+		statcache_ent_t **old = s->buckets, *o, *next;
+		size_t nold = s->mask + 1, i;
+		s->mask = nold * 2 - 1;
+		s->buckets = xmalloc(nold * 2 * sizeof *s->buckets);
+		memset(s->buckets, 0, nold * 2 * sizeof *s->buckets);
+		for (i = 0; i < nold; i++)
+			for (o = old[i]; NULL != o; o = next) {
+				next = o->next;
+				link = statcache_bucket(s, o->hash);
+				o->next = *link;
+				*link = o;
+			}
+		xfree(old);
+	}
+	link = statcache_find(s, path, hash);
+	if (NULL != *link) { /* replace it */
+		statcache_ent_t *old = *link;
+		e->next = old->next;
+		*link = e;
+		xfree(old);
+	} else {
+		e->next = NULL;
+		*link = e;
+		s->used++;
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* forget path, if we had it */
+static void statcache_drop(statcache_t *c, const char *path)
+{
+	size_t hash = statcache_hash(path);
+	statcache_shard_t *s = statcache_shard(c, hash);
+	statcache_ent_t **link, *e;
+	pthread_mutex_lock(&s->lock);
+	link = statcache_find(s, path, hash);
+	if (NULL != (e = *link)) {
+		*link = e->next;
+		s->used--;
+	}
+	pthread_mutex_unlock(&s->lock);
+	xfree(e);
+}
+
+#ifdef STATCACHE_INOTIFY
+
+/* fs types where somebody else can change things without inotify hearing of it */
+static const unsigned long STATCACHE_REMOTE[] = {
+	0x6969, /* nfs */
+	0x517b, /* smb */
+	0xff534d42, /* cifs */
+	0xfe534d42, /* smb2 */
+	0x65735546, /* fuse */
+	0x00c36400, /* ceph */
+	0x5346414f, /* afs */
+	0x73757245, /* coda */
+	0x01021997, /* 9p */
+	0x01161970, /* gfs2 */
+	0x7461636f, /* ocfs2 */
+	0x0bd00bd0 /* lustre */
+};
+
+/* watch dir path, the lstat() of which is st, for changes to it and its names */
+/* returns the watch, or -1 if what's in it will have to do with a TTL */
+static int statcache_watch(statcache_t *c, const char *path, const struct stat *st)
+{
+	struct statfs sfs;
+	struct stat now;
+	statcache_watch_t *w, **link;
+	size_t i, len;
+	int wd;
+
+	if (-1 == c->ifd || -1 == statfs(path, &sfs))
+		return -1;
+	for (i = 0; i < sizeof STATCACHE_REMOTE / sizeof STATCACHE_REMOTE[0]; i++)
+		if ((unsigned long)sfs.f_type == STATCACHE_REMOTE[i])
+			return -1;
+
+	pthread_mutex_lock(&c->watch_lock);
+	if (c->nwatches >= STATCACHE_WATCHES
+		|| -1 == (wd = inotify_add_watch(c->ifd, path,
+			IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF
+			| IN_ONLYDIR | IN_DONT_FOLLOW))) {
+		pthread_mutex_unlock(&c->watch_lock);
+		return -1;
+	}
+	/* the same dir twice is the same watch, under two paths (bind mounts) */
+	/* we'd only hear about one of them */
+	if (NULL != (w = statcache_watch_find(c, wd))) {
+		pthread_mutex_unlock(&c->watch_lock);
+		return (0 == strcmp(w->path, path) ? wd : -1);
+	}
+	if (c->nwatches + 1 > c->watch_mask + 1) { /* keep chains short, move everything over */
+		statcache_watch_t **old = c->watches, *o, *next;
+		size_t nold = c->watch_mask + 1;
+		c->watch_mask = nold * 2 - 1;
+		c->watches = xmalloc(nold * 2 * sizeof *c->watches);
+		memset(c->watches, 0, nold * 2 * sizeof *c->watches);
+		for (i = 0; i < nold; i++)
+			for (o = old[i]; NULL != o; o = next) {
+				next = o->next;
+				link = &c->watches[(size_t)o->wd & c->watch_mask];
+				o->next = *link;
+				*link = o;
+			}
+		xfree(old);
+	}
+	len = strlen(path);
+	w = xmalloc(sizeof *w + len + 1);
+	w->wd = wd;
+	memcpy(w->path, path, len + 1);
+	link = &c->watches[(size_t)wd & c->watch_mask];
+	w->next = *link;
+	*link = w;
+	c->nwatches++;
+	pthread_mutex_unlock(&c->watch_lock);
+
+	/* something could have taken its place since the walk lstat()ed it, or */
+	/* been chmod/chown'ed before the watch was up to hear of it, either way */
+	/* the watch is right for path but st isn't */
+	if (-1 == lstat(path, &now) || now.st_ino != st->st_ino || now.st_dev != st->st_dev
+			|| now.st_ctim.tv_sec != st->st_ctim.tv_sec || now.st_ctim.tv_nsec != st->st_ctim.tv_nsec
+			|| now.st_mode != st->st_mode || now.st_uid != st->st_uid || now.st_gid != st->st_gid)
+		return -1;
+	return wd;
+}
+
+/* caller holds watch_lock */
+static statcache_watch_t *statcache_watch_find(const statcache_t *c, int wd)
+{
+	statcache_watch_t *w;
+	for (w = c->watches[(size_t)wd & c->watch_mask]; NULL != w; w = w->next)
+		if (w->wd == wd)
+			break;
+	return w;
+}
+
+/* stop watching everything, caller holds watch_lock */
+static void statcache_unwatch(statcache_t *c)
+{
+	statcache_watch_t *w, *next;
+	size_t i;
+	for (i = 0; i <= c->watch_mask; i++) {
+		for (w = c->watches[i]; NULL != w; w = next) {
+			next = w->next;
+			inotify_rm_watch(c->ifd, w->wd);
+			xfree(w);
+		}
+		c->watches[i] = NULL;
+	}
+	c->nwatches = 0;
+}
+
+/* drop whatever's changed since the last time we looked */
+/* a dir that moved or went away takes every path under it with it, and */
+/* those aren't worth hunting down one by one, so that empties the lot */
+void statcache_sync(statcache_t *c)
+{
+	union {
+		struct inotify_event ev; /* for the alignment */
+		char buf[4096];
+	} u;
+	const struct inotify_event *ev;
+	statcache_watch_t *w;
+	ssize_t got;
+	char *p;
+	int flush = 0;
+#ifdef DEBUG
+	assert(NULL != c);
+#endif
+
+	if (-1 == c->ifd)
+		return;
+	pthread_mutex_lock(&c->watch_lock);
+	while (0 < (got = read(c->ifd, u.buf, sizeof u.buf))) {
+		for (p = u.buf; p < u.buf + got; p += sizeof *ev + ev->len) {
+			ev = (const struct inotify_event *)p;
+			if (ev->mask & IN_Q_OVERFLOW) { /* lost some, no telling which */
+				flush = 1;
+				continue;
+			}
+			if (NULL == (w = statcache_watch_find(c, ev->wd)))
+				continue; /* one we've already dropped */
+			if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_UNMOUNT)) {
+				flush = 1;
+			} else if (0 == ev->len) { /* the dir itself */
+				statcache_drop(c, w->path);
+			} else {
+				size_t dlen = strlen(w->path), nlen = strlen(ev->name);
+				char *path = xmalloc(dlen + 1 + nlen + 1);
+				memcpy(path, w->path, dlen);
+				if (dlen > 1) /* no PATHSEP after "/" */
+					path[dlen++] = '/';
+				memcpy(path + dlen, ev->name, nlen + 1);
+				statcache_drop(c, path);
+				xfree(path);
+			}
+		}
+	}
+	pthread_mutex_unlock(&c->watch_lock);
+	if (flush)
+		statcache_flush(c);
+}
+
+#else /* no inotify, every entry has a TTL */
+
+#define statcache_watch(c, path, st)	(-1)
+#define statcache_unwatch(c)
+
+void statcache_sync(statcache_t *c)
+{
+}
+
+#endif
+
+/* forget everything, for when what's changed is too much to pick through */
+void statcache_flush(statcache_t *c)
+{
+	size_t i;
+#ifdef DEBUG
+	assert(NULL != c);
+#endif
+	pthread_mutex_lock(&c->watch_lock);
+	statcache_unwatch(c);
+	for (i = 0; i < STATCACHE_SHARDS; i++) {
+		statcache_shard_t *s = &c->shards[i];
+		pthread_mutex_lock(&s->lock);
+		statcache_reset(s, s->mask + 1);
+		pthread_mutex_unlock(&s->lock);
+	}
+	pthread_mutex_unlock(&c->watch_lock);
+}
+
+void statcache_free(statcache_t *c)
+{
+	size_t i;
+	if (NULL == c)
+		return;
+	pthread_mutex_lock(&c->watch_lock);
+	statcache_unwatch(c);
+	pthread_mutex_unlock(&c->watch_lock);
+	if (-1 != c->ifd)
+		close(c->ifd);
+	xfree(c->watches);
+	pthread_mutex_destroy(&c->watch_lock);
+	for (i = 0; i < STATCACHE_SHARDS; i++) {
+		statcache_ent_t *e, *next;
+		size_t j;
+		for (j = 0; j <= c->shards[i].mask; j++)
+			for (e = c->shards[i].buckets[j]; NULL != e; e = next) {
+				next = e->next;
+				xfree(e);
+			}
+		xfree(c->shards[i].buckets);
+		pthread_mutex_destroy(&c->shards[i].lock);
+	}
+	xfree(c);
+}
+
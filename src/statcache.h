@@ -0,0 +1,56 @@
+/* ex: set ts=4: */
+
+#ifndef STATCACHE_H
+#define STATCACHE_H
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+/*
+	lstat()s path_split() has already done, by abspath, for when shac stays
+	up (batch, serve) and every query walks down through the same few
+	dirs. an entry holds what the walk needs of a struct stat and stands
+	until something says otherwise: each cached dir is watched with
+	inotify, and a change to it or a name in it drops the entry. on a fs
+	where changes can come from elsewhere (nfs and the like), or a dir we
+	couldn't watch, what's in it only stands for STATCACHE_TTL_NSEC.
+
+	entries go by path, and inotify on a dir only hears about changes made
+	through a name in it. a file with other hard links can have its mode
+	or owner changed through one of those without us hearing a thing, so
+	anything but a dir with st_nlink > 1 is never cached.
+
+	entries are spread over shards by hash, each with its own lock, so a
+	lookup never waits on the whole cache.
+*/
+
+#define STATCACHE_SHARDS	16
+
+typedef struct statcache_ent statcache_ent_t;
+typedef struct statcache_watch statcache_watch_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	statcache_ent_t **buckets; /* chained, power of 2 of them */
+	size_t mask; /* buckets - 1 */
+	size_t used;
+} statcache_shard_t;
+
+typedef struct {
+	statcache_shard_t shards[STATCACHE_SHARDS];
+	int ifd; /* inotify, -1 if we have none and everything gets a TTL */
+	pthread_mutex_t watch_lock; /* watches, and reading ifd */
+	statcache_watch_t **watches; /* by wd, chained, power of 2 of them */
+	size_t watch_mask;
+	size_t nwatches;
+} statcache_t;
+
+statcache_t *statcache_alloc(void);
+int statcache_get(statcache_t *, const char *, struct stat *);
+void statcache_put(statcache_t *, const char *, const char *, const struct stat *);
+void statcache_sync(statcache_t *);
+void statcache_flush(statcache_t *);
+void statcache_free(statcache_t *);
+
+#endif
+
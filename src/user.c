@@ -6,92 +6,8 @@
 #include "user.h"
 #include "util.h"
 
-group_t * group_alloc(void)
-{
-	group_t *grp = xmalloc(sizeof *grp);
-	grp->name = NULL;
-	group_init(grp);
-	return grp;
-}
-
-/* initialize group_t */
-void group_init(group_t *grp)
-{
-#ifdef DEBUG
-	assert(NULL != grp);
-#endif
-	xfree(grp->name);
-	grp->name = NULL;
-	grp->gid = GROUP_NONE;
-}
-
-/* generate a group_t from a struct group */
-group_t *group_gen(const struct group *grp)
-{
-	group_t *g = NULL;
-#ifdef DEBUG
-	assert(NULL != grp);
-#endif
-
-	g = group_alloc();
-
-	/* copy gid */
-	g->gid = grp->gr_gid;
-
-	/* copy group name if there is one */
-	if (NULL != grp->gr_name)
-		if (NULL == (g->name = strdup(grp->gr_name)))
-			err_bail(__FILE__, __LINE__, "could not strdup group name!");
-
-	return g;
-	
-}
-
-/* dump group, callback to list_dump() by ways of user_dump() */
-void group_dump(const void *ptr)
-{
-	const group_t *grp = NULL;
-#ifdef DEBUG
-	assert(NULL != ptr);
-#endif
-	grp = ptr;
-	fprintf(stdout, "\tgroup_t(%p){\n\t\tgid: %d\n\t\tname: \"%s\"\n\t}\n",
-		(void *)grp, grp->gid, grp->name);
-}
-
-void * group_dupe(const void *v)
-{
-	const group_t *orig;
-	group_t *dupe;
-#ifdef DEBUG
-	assert(NULL != v);
-#endif
-
-	orig = v;
-	dupe = group_alloc();
-
-	dupe->gid = orig->gid;
-	if (NULL != orig->name)
-		dupe->name = strdup(orig->name);
-
-	return dupe;
-}
-
-void group_free(void *g)
-{
-	group_t *grp;
-#ifdef DEBUG
-	assert(NULL != grp);
-#endif
-	grp = g;
-	if (NULL == grp)
-		return;
-	xfree(grp->name);
-	xfree(grp);
-}
-
-/**************** end groups *******************/
-
+/* gids are mostly small and close together, scatter them over the set */
+#define gid_hash(gid)	((size_t)((unsigned)(gid) * 2654435761u))
 
 /* initialize user_t */
 user_t * user_init(void)
@@ -108,10 +24,10 @@ user_t * user_init(void)
 	user->is_user = 0;
 	user->uid = USER_NONE;
 	user->gid = GROUP_NONE;
-
-	/* create empty list for groups */
-	if (NULL == (user->groups = list_head_create()))
-		err_bail(__FILE__, __LINE__, "can't create user->groups!");
+	user->groups = NULL;
+	user->ngroups = 0;
+	user->groupset = NULL;
+	user->groupset_mask = 0;
 
 	return user;
 }
@@ -119,16 +35,18 @@ user_t * user_init(void)
 /* meant for our own use */
 void user_dump(const user_t *user)
 {
+	size_t i;
 #ifdef DEBUG
 	assert(NULL != user);
 #endif
 
-	fprintf(stdout, "user_t(%p){\n\tname: \"%s\"\n\tis_user: %d\n\tuid: %d\n\tgid: %d\n\tgroups:\n",
+	fprintf(stdout, "user_t(%p){\n\tname: \"%s\"\n\tis_user: %d\n\tuid: %d\n\tgid: %d\n\tgroups:",
 		(void *)user, user->name, (int)user->is_user, (int)user->uid, (int)user->gid);
 
-	list_dump(user->groups, group_dump);
+	for (i = 0; i < user->ngroups; i++)
+		fprintf(stdout, " %d", (int)user->groups[i]);
 
-	fprintf(stdout, "}\n");
+	fprintf(stdout, "\n}\n");
 
 }
 
@@ -139,7 +57,8 @@ void user_free(user_t *user)
 #endif
 
 	xfree(user->name); /* free name */
-	list_free(user->groups, group_free);
+	xfree(user->groups);
+	xfree(user->groupset);
 	xfree(user); /* free the pointer */
 }
 
@@ -177,100 +96,73 @@ user_t * user_load(const char *username)
 	return u;
 }
 
-/* append data from a group entry to the user's group list */
-void user_group_add(user_t *user, const struct group *grp)
-{
-	group_t *g = NULL;
-	list_node *node = NULL;
-
-#ifdef DEBUG
-	assert(NULL != user);
-#endif
-
-	g = group_gen(grp);
-	/* create shallow copy */
-	node = list_node_create_deep(g, group_dupe);
-	/* add entry to groups list */
-	if (NULL == list_append(user->groups, node))
-		err_bail(__FILE__, __LINE__, "could not append group node!");
-	/* stop processing group */
-	group_free(g);
-}
-
 /* loads user's groups */
+/* getgrouplist() asks nss about this one user instead of us reading every */
+/* group there is, which with ldap or sssd behind it can be a lot of groups */
 void user_groups_load(user_t *user)
 {
-
-	struct group *grp = NULL;
-	char **u = NULL;
+	int n = 32, cap = 32, i, last;
+	size_t size;
 
 #ifdef DEBUG
 	assert(NULL != user);
 #endif
 
-	/* open stream to group db */
-	setgrent();
-
-	while (NULL != (grp = getgrent())) {
-#ifdef DEBUG
-#if 0
-		printf("user_groups_load(%p):%d grp(%p)\n",
-			(void *)user, __LINE__, (void *)grp);
-#endif
-#endif
-		if (user->gid == grp->gr_gid) {
-			/* matched user's gid entry from /etc/passwd */
-			user_group_add(user, grp);
-		} else {
-			/* see if it's in /etc/group */
-			u = grp->gr_mem;
-			while (NULL != *u) {
-#ifdef DEBUG
-#if 0
-			printf("user_groups_load(%p):%d u(%p) \"%s\"\n",
-				(void *)user, __LINE__, (void *)u, *u);
-#endif
-#endif
-				/* if user is in group... */
-				if (0 == strcmp(user->name, *u)) {
-					user_group_add(user, grp);
-					break;
-				}
-				u++;
-			}
-		}
+	user->groups = xmalloc(cap * sizeof *user->groups);
+	while (-1 == getgrouplist(user->name, user->gid, user->groups, &n)) {
+		/* glibc sets n to how many it needs, others leave it be */
+		cap = (n > cap ? n : cap * 2);
+		n = cap;
+		user->groups = xrealloc(user->groups, cap * sizeof *user->groups);
 	}
 
-	/* close group db */
-	endgrent();
-
+	/* sorted and unique, the primary group may be listed twice */
+	qsort(user->groups, n, sizeof *user->groups, gid_cmp);
+	for (i = 1, last = 0; i < n; i++)
+		if (user->groups[i] != user->groups[last])
+			user->groups[++last] = user->groups[i];
+	user->ngroups = (n > 0 ? last + 1 : 0);
+
+	/* and hashed, so user_in_group() is one or two probes */
+	for (size = 8; size < user->ngroups * 2; size <<= 1)
+		;
+	user->groupset = xmalloc(size * sizeof *user->groupset);
+	user->groupset_mask = size - 1;
+	for (i = 0; i < (int)size; i++)
+		user->groupset[i] = (gid_t)GROUP_NONE;
+	for (i = 0; i < (int)user->ngroups; i++) {
+		size_t slot = gid_hash(user->groups[i]) & user->groupset_mask;
+		while ((gid_t)GROUP_NONE != user->groupset[slot])
+			slot = (slot + 1) & user->groupset_mask;
+		user->groupset[slot] = user->groups[i];
+	}
 }
 
+/* qsort() callback */
 int gid_cmp(const void *a, const void *b)
 {
+	gid_t ga = *(const gid_t *)a, gb = *(const gid_t *)b;
 #ifdef DEBUG
 	assert(NULL != a);
 	assert(NULL != b);
-#if 0
-	printf("gid_cmp(%d, %d)\n",
-		*((gid_t *)a), *((gid_t *)b));
 #endif
-#endif
-	return (*((gid_t *)a) == *((gid_t *)b) ? 0 : 1);
+	return (ga < gb ? -1 : ga > gb);
 }
 
-/* returns !0 if user is in group by gid. FIXME: perhaps this should be a macro? */
+/* returns !0 if user is in group by gid */
 int user_in_group(const user_t *user, const gid_t gid)
 {
+	size_t slot;
 #ifdef DEBUG
 	assert(NULL != user);
-	assert(NULL != user->groups);
-#if 0
-	printf("user_in_group(%p, %d)\n",
-		(void *)user, (int)gid);
-#endif
-#endif
-	return (NULL == list_search(list_first(user->groups), gid_cmp, &gid) ? 0 : 1);
+	assert(NULL != user->groupset);
+#endif
+	for (slot = gid_hash(gid) & user->groupset_mask;
+		(gid_t)GROUP_NONE != user->groupset[slot];
+		slot = (slot + 1) & user->groupset_mask)
+		if (gid == user->groupset[slot])
+			return 1;
+	return 0;
 }
 
 /* fetch current username */
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <ctype.h>  /* isdigit */
 #include <unistd.h> /* readlink */
+#include <fcntl.h> /* AT_FDCWD */
 #include "shac.h"
 #include "util.h"
 
@@ -135,7 +136,14 @@ void xfree(void *ptr)
 /* allocate and read buffer for the filename that filename, a symlink, points to */
 char * readlink_malloc(const char *filename)
 {
-	int size = 64;
+	return readlinkat_malloc(AT_FDCWD, filename, 0);
+}
+
+/* same as readlink_malloc(), filename relative to the directory dirfd */
+/* len is how long the target should be, st_size from lstat(), 0 if unknown */
+char * readlinkat_malloc(int dirfd, const char *filename, size_t len)
+{
+	int size = (len > 0 ? (int)len + 1 : 64); /* room to tell it wasn't cut short */
 	char *buf = NULL;
 #ifdef DEBUG
 	assert(NULL != filename);
@@ -143,12 +151,14 @@ char * readlink_malloc(const char *filename)
 	while (1) {
 		int nchars;
 		buf = xrealloc(buf, size); /* grab some [more] space */
-		nchars = readlink(filename, buf, size); /* read filename */
+		nchars = readlinkat(dirfd, filename, buf, size); /* read filename */
 		if (nchars < 0) { /* error */
 			xfree(buf);
 			return NULL;
-		} else if (nchars < size) /* life is good */
+		} else if (nchars < size) { /* life is good */
+			buf[nchars] = '\0'; /* readlink() doesn't terminate */
 			return buf;
+		}
 		size *= 2; /* increase buffer size */
 	}
 }
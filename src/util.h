@@ -25,6 +25,7 @@ void *xmalloc(size_t); /* malloc() wrapper, bails on fails */
 void *xrealloc(void *, size_t); /* checks NULL, will realloc */
 void xfree(void *);
 char *readlink_malloc(const char *);
+char *readlinkat_malloc(int, const char *, size_t);
 char *strnchr(const char *, char);
 char *strndup(const char *, size_t);
 char *strapp(char *, const char *);
@@ -0,0 +1,130 @@
+/* ex: set ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef DEBUG
+#include <assert.h>
+#endif
+#include "vec.h"
+#include "util.h"
+
+#define VEC_MIN	8 /* items in the first block we malloc() */
+
+/* a vec of its own, items of size bytes */
+vec_t *vec_alloc(size_t size)
+{
+	vec_t *v = xmalloc(sizeof *v);
+	vec_init(v, size, NULL, 0);
+	return v;
+}
+
+/* set up a vec in place, starting on the caller's buffer inl of inlcap items */
+/* inl may be NULL, then the first push malloc()s */
+void vec_init(vec_t *v, size_t size, void *inl, size_t inlcap)
+{
+#ifdef DEBUG
+	assert(NULL != v);
+	assert(size > 0);
+#endif
+	v->items = inl;
+	v->inl = inl;
+	v->size = size;
+	v->len = 0;
+	v->cap = (NULL == inl ? 0 : inlcap);
+}
+
+/* make room for at least n items in all */
+void vec_reserve(vec_t *v, size_t n)
+{
+	size_t cap;
+	if (n <= v->cap)
+		return;
+	for (cap = (v->cap < VEC_MIN ? VEC_MIN : v->cap); cap < n; cap <<= 1)
+		;
+	if (v->items == v->inl) { /* moving off the inline buffer, or nothing yet */
+		void *items = xmalloc(cap * v->size);
+		if (v->len > 0)
+			memcpy(items, v->items, v->len * v->size);
+		v->items = items;
+	} else {
+		v->items = xrealloc(v->items, cap * v->size);
+	}
+	v->cap = cap;
+}
+
+/* copy item onto the end, or zero the new slot if item is NULL */
+/* returns the new slot, good until the next push */
+void *vec_push(vec_t *v, const void *item)
+{
+	void *slot;
+#ifdef DEBUG
+	assert(NULL != v);
+#endif
+	if (v->len == v->cap)
+		vec_reserve(v, v->len + 1);
+	slot = (char *)v->items + v->len * v->size;
+	if (NULL == item)
+		memset(slot, 0, v->size);
+	else
+		memcpy(slot, item, v->size);
+	v->len++;
+	return slot;
+}
+
+/* copy every item of src onto the end of v, items must be the same size */
+void vec_append(vec_t *v, const vec_t *src)
+{
+#ifdef DEBUG
+	assert(NULL != v);
+	assert(NULL != src);
+	assert(v->size == src->size);
+#endif
+	if (0 == src->len)
+		return;
+	vec_reserve(v, v->len + src->len);
+	memcpy((char *)v->items + v->len * v->size, src->items, src->len * v->size);
+	v->len += src->len;
+}
+
+/* copy len chars of s and a '\0' onto string table v, s may be in v already */
+/* returns where it starts */
+stroff_t strtab_add(vec_t *v, const char *s, size_t len)
+{
+	size_t off = v->len;
+#ifdef DEBUG
+	assert(1 == v->size);
+#endif
+	if (s >= (char *)v->items && s < (char *)v->items + v->len) { /* about to move */
+		size_t soff = s - (char *)v->items;
+		vec_reserve(v, off + len + 1);
+		s = (char *)v->items + soff;
+	}
+	vec_reserve(v, off + len + 1);
+	memcpy((char *)v->items + off, s, len);
+	((char *)v->items)[off + len] = '\0';
+	v->len += len + 1;
+	return (stroff_t)off;
+}
+
+/* give back what vec_init()ed v malloc()ed, v itself is the caller's */
+/* whatever the items point to is the caller's business */
+void vec_destroy(vec_t *v)
+{
+	if (NULL == v)
+		return;
+	if (v->items != v->inl)
+		xfree(v->items);
+	v->items = v->inl;
+	v->len = v->cap = 0;
+}
+
+/* free a vec from vec_alloc() */
+void vec_free(vec_t *v)
+{
+	if (NULL == v)
+		return;
+	vec_destroy(v);
+	xfree(v);
+}
+
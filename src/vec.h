@@ -0,0 +1,63 @@
+/* ex: set ts=4: */
+
+#ifndef VEC_H
+#define VEC_H
+
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uint32_t */
+
+/*
+	growable array of fixed-size items, stored back to back. walking one is
+	a pass over a single block instead of a chase down next pointers, and an
+	item costs nothing to add until the block has to grow.
+
+	a vec can start out on a buffer its owner provides, see VEC_SMALL(), and
+	only goes to the heap once that's full. items move when the block grows,
+	so don't hold a pointer to one across a vec_push().
+*/
+
+typedef struct {
+	void *items;
+	size_t size; /* bytes per item */
+	size_t len, cap; /* items used, items room for */
+	void *inl; /* owner's buffer, items starts here, NULL if none */
+} vec_t;
+
+/* a vec with room for n items of type inline, so short ones never malloc() */
+/* set up with vec_init_small(), use &s->vec, don't copy it by value */
+#define VEC_SMALL(type, n)	struct { vec_t vec; type inl[n]; }
+#define vec_init_small(s, type) \
+	vec_init(&(s)->vec, sizeof(type), (s)->inl, sizeof (s)->inl / sizeof(type))
+
+#define vec_len(v)				((v)->len)
+#define vec_ptr(v, type, i)		((type *)(v)->items + (i))
+#define vec_at(v, type, i)		(((type *)(v)->items)[i])
+#define vec_first(v, type)		vec_ptr(v, type, 0)
+#define vec_last(v, type)		vec_ptr(v, type, (v)->len - 1)
+#define vec_end(v, type)		vec_ptr(v, type, (v)->len)
+#define vec_pop(v)				((v)->len--)
+#define vec_clear(v)			((v)->len = 0)
+#define vec_truncate(v, n)		((v)->len = (n))
+
+/*
+	a vec of chars works as a string table: strings go in back to back and
+	are referred to by offset, which stays good when the block moves. give
+	back everything added since some point with vec_truncate() to the
+	vec_len() from then.
+*/
+typedef uint32_t stroff_t;
+#define STROFF_NONE	((stroff_t)-1)
+#define strtab_at(v, off)	((char *)(v)->items + (off))
+#define strtab_str(v, off)	(STROFF_NONE == (off) ? NULL : strtab_at(v, off)) /* NULL if none */
+
+vec_t *vec_alloc(size_t);
+void vec_init(vec_t *, size_t, void *, size_t);
+void vec_reserve(vec_t *, size_t);
+void *vec_push(vec_t *, const void *);
+void vec_append(vec_t *, const vec_t *);
+void vec_destroy(vec_t *);
+stroff_t strtab_add(vec_t *, const char *, size_t);
+void vec_free(vec_t *);
+
+#endif
+
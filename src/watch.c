@@ -0,0 +1,473 @@
+/* ex: set ts=4: */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#ifdef DEBUG
+#include <assert.h>
+#endif
+#include "watch.h"
+#include "mnt.h"
+#include "util.h"
+
+#if defined(__linux__)
+
+#include <sys/inotify.h>
+
+/* anything that can change who gets at a path or what it leads to */
+#define WATCH_EVENTS	(IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+						| IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+#define WATCH_MIN		64 /* buckets to start with */
+
+/* keys and dirs are both looked up by path, this heads each */
+typedef struct watch_node watch_node_t;
+struct watch_node {
+	watch_node_t *next;
+	size_t hash;
+	const char *path; /* the path[] of whatever we head */
+};
+
+typedef struct {
+	watch_node_t **buckets; /* chained, power of 2 of them */
+	size_t mask;
+	size_t n;
+} watch_tab_t;
+
+/* a dir with keys in it, watched for news of them */
+typedef struct watch_dir watch_dir_t;
+struct watch_dir {
+	watch_node_t node;
+	watch_dir_t *wdnext; /* in wds */
+	int wd; /* -1 if we can't watch it right now, see watch_retry() */
+	size_t refs; /* keys in it */
+	char path[];
+};
+
+/* a path some answers depend on */
+typedef struct watch_key watch_key_t;
+struct watch_key {
+	watch_node_t node;
+	watch_dir_t *dir; /* the dir it's in, "/" is in itself */
+	vec_t ids; /* size_t, an id can be in twice while watch_set() swaps its keys */
+	unsigned long mark; /* watch_set() call that last took it */
+	char path[];
+};
+
+struct watch {
+	int ifd;
+	int mntfd; /* nothing says when a mount lands on a dir, this does */
+	watch_tab_t keys; /* watch_key_t */
+	watch_tab_t dirs; /* watch_dir_t */
+	watch_dir_t **wds; /* dirs again, by wd, dirs.mask + 1 of them */
+	vec_t deps; /* vec_t of watch_key_t * for each id */
+	vec_t hit; /* char for each id, watch_wait() marks the ones it's found */
+	unsigned long mark; /* watch_set() calls so far */
+};
+
+static size_t watch_hash(const char *, size_t);
+static void watch_tab_init(watch_tab_t *);
+static watch_node_t **watch_tab_find(const watch_tab_t *, const char *, size_t);
+static void watch_tab_add(watch_tab_t *, watch_node_t *);
+static watch_key_t *watch_key(watch_t *, const char *, size_t);
+static void watch_key_unref(watch_t *, watch_key_t *, size_t);
+static watch_dir_t *watch_dir(watch_t *, const char *, size_t);
+static void watch_dir_unref(watch_t *, watch_dir_t *);
+static void watch_dir_on(watch_t *, watch_dir_t *);
+static void watch_dir_off(watch_t *, watch_dir_t *);
+static watch_dir_t *watch_wd(const watch_t *, int);
+static void watch_hit(watch_t *, const char *, size_t);
+static void watch_retry(watch_t *);
+
+static size_t watch_hash(const char *path, size_t len)
+{
+	unsigned long long h = 0xcbf29ce484222325ULL; /* fnv-1a */
+	while (len-- > 0)
+		h = (h ^ (unsigned char)*path++) * 0x100000001b3ULL;
+	return (size_t)(h ^ (h >> 32));
+}
+
+static void watch_tab_init(watch_tab_t *t)
+{
+	t->buckets = xmalloc(WATCH_MIN * sizeof *t->buckets);
+	memset(t->buckets, 0, WATCH_MIN * sizeof *t->buckets);
+	t->mask = WATCH_MIN - 1;
+	t->n = 0;
+}
+
+/* the link to the first len chars of path in t, or the NULL at the end of its chain */
+static watch_node_t **watch_tab_find(const watch_tab_t *t, const char *path, size_t len)
+{
+	size_t hash = watch_hash(path, len);
+	watch_node_t **link;
+	for (link = &t->buckets[hash & t->mask]; NULL != *link; link = &(*link)->next)
+		if ((*link)->hash == hash && 0 == strncmp((*link)->path, path, len) && '\0' == (*link)->path[len])
+			break;
+	return link;
+}
+
+/* node isn't in t yet, its hash and path are filled in */
+static void watch_tab_add(watch_tab_t *t, watch_node_t *node)
+{
+	watch_node_t **link;
+	if (t->n + 1 > t->mask + 1) { /* keep chains short, move everything over */
+		watch_node_t **old = t->buckets, *o, *next;
+		size_t nold = t->mask + 1, i;
+		t->mask = nold * 2 - 1;
+		t->buckets = xmalloc(nold * 2 * sizeof *t->buckets);
+		memset(t->buckets, 0, nold * 2 * sizeof *t->buckets);
+		for (i = 0; i < nold; i++)
+			for (o = old[i]; NULL != o; o = next) {
+				next = o->next;
+				link = &t->buckets[o->hash & t->mask];
+				o->next = *link;
+				*link = o;
+			}
+		xfree(old);
+	}
+	link = &t->buckets[node->hash & t->mask];
+	node->next = *link;
+	*link = node;
+	t->n++;
+}
+
+watch_t *watch_alloc(void)
+{
+	watch_t *w = xmalloc(sizeof *w);
+	if (-1 == (w->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)))
+		fatal("could not set up inotify for --watch");
+	w->mntfd = mnt_watch();
+	watch_tab_init(&w->keys);
+	watch_tab_init(&w->dirs);
+	w->wds = xmalloc((w->dirs.mask + 1) * sizeof *w->wds);
+	memset(w->wds, 0, (w->dirs.mask + 1) * sizeof *w->wds);
+	vec_init(&w->deps, sizeof(vec_t), NULL, 0);
+	vec_init(&w->hit, 1, NULL, 0);
+	w->mark = 0;
+	return w;
+}
+
+/* the key for the first len chars of path, made if we don't have it */
+static watch_key_t *watch_key(watch_t *w, const char *path, size_t len)
+{
+	watch_node_t **link = watch_tab_find(&w->keys, path, len);
+	watch_key_t *k;
+	size_t dlen;
+	if (NULL != *link)
+		return (watch_key_t *)*link;
+	k = xmalloc(sizeof *k + len + 1);
+	memcpy(k->path, path, len);
+	k->path[len] = '\0';
+	k->node.path = k->path;
+	k->node.hash = watch_hash(path, len);
+	vec_init(&k->ids, sizeof(size_t), NULL, 0);
+	k->mark = 0;
+	/* news of a name comes from the dir it's in */
+	for (dlen = len; dlen > 1 && '/' != path[dlen - 1]; dlen--)
+		;
+	if (dlen > 1)
+		dlen--; /* no trailing PATHSEP, unless it's "/" */
+	k->dir = watch_dir(w, path, dlen);
+	watch_tab_add(&w->keys, &k->node);
+	return k;
+}
+
+/* id doesn't depend on k anymore */
+static void watch_key_unref(watch_t *w, watch_key_t *k, size_t id)
+{
+	watch_node_t **link;
+	size_t i;
+	for (i = 0; i < vec_len(&k->ids); i++)
+		if (vec_at(&k->ids, size_t, i) == id) {
+			vec_at(&k->ids, size_t, i) = vec_at(&k->ids, size_t, vec_len(&k->ids) - 1);
+			vec_pop(&k->ids);
+			break;
+		}
+	if (vec_len(&k->ids) > 0)
+		return;
+	link = watch_tab_find(&w->keys, k->path, strlen(k->path));
+	*link = k->node.next;
+	w->keys.n--;
+	watch_dir_unref(w, k->dir);
+	vec_destroy(&k->ids);
+	xfree(k);
+}
+
+/* the dir for the first len chars of path, made and watched if we don't have it */
+static watch_dir_t *watch_dir(watch_t *w, const char *path, size_t len)
+{
+	watch_node_t **link = watch_tab_find(&w->dirs, path, len);
+	watch_dir_t *d;
+	size_t nold = w->dirs.mask + 1, i;
+	if (NULL != *link) {
+		d = (watch_dir_t *)*link;
+		d->refs++;
+		return d;
+	}
+	d = xmalloc(sizeof *d + len + 1);
+	memcpy(d->path, path, len);
+	d->path[len] = '\0';
+	d->node.path = d->path;
+	d->node.hash = watch_hash(path, len);
+	d->refs = 1;
+	d->wd = -1;
+	watch_tab_add(&w->dirs, &d->node);
+	if (w->dirs.mask + 1 != nold) { /* wds grows along with dirs */
+		watch_dir_t **old = w->wds, *o, *next;
+		w->wds = xmalloc((w->dirs.mask + 1) * sizeof *w->wds);
+		memset(w->wds, 0, (w->dirs.mask + 1) * sizeof *w->wds);
+		for (i = 0; i < nold; i++)
+			for (o = old[i]; NULL != o; o = next) {
+				next = o->wdnext;
+				o->wdnext = w->wds[(size_t)o->wd & w->dirs.mask];
+				w->wds[(size_t)o->wd & w->dirs.mask] = o;
+			}
+		xfree(old);
+	}
+	watch_dir_on(w, d);
+	return d;
+}
+
+static void watch_dir_unref(watch_t *w, watch_dir_t *d)
+{
+	watch_node_t **link;
+	if (--d->refs > 0)
+		return;
+	watch_dir_off(w, d);
+	link = watch_tab_find(&w->dirs, d->path, strlen(d->path));
+	*link = d->node.next;
+	w->dirs.n--;
+	xfree(d);
+}
+
+/* start watching d, if it's there to watch */
+static void watch_dir_on(watch_t *w, watch_dir_t *d)
+{
+	int wd = inotify_add_watch(w->ifd, d->path, WATCH_EVENTS);
+	/* the same dir under two paths (bind mounts) is one watch, news of */
+	/* it would only come to one of them. the other goes without */
+	if (-1 == wd || NULL != watch_wd(w, wd))
+		return;
+	d->wd = wd;
+	d->wdnext = w->wds[(size_t)wd & w->dirs.mask];
+	w->wds[(size_t)wd & w->dirs.mask] = d;
+}
+
+/* stop watching d, whatever's at its path now gets watched by watch_retry() */
+static void watch_dir_off(watch_t *w, watch_dir_t *d)
+{
+	watch_dir_t **link;
+	if (-1 == d->wd)
+		return;
+	for (link = &w->wds[(size_t)d->wd & w->dirs.mask]; *link != d; link = &(*link)->wdnext)
+		;
+	*link = d->wdnext;
+	inotify_rm_watch(w->ifd, d->wd); /* EINVAL if the kernel beat us to it */
+	d->wd = -1;
+}
+
+static watch_dir_t *watch_wd(const watch_t *w, int wd)
+{
+	watch_dir_t *d;
+	for (d = w->wds[(size_t)wd & w->dirs.mask]; NULL != d; d = d->wdnext)
+		if (d->wd == wd)
+			break;
+	return d;
+}
+
+/* id's answer depends on every path in deps, one string after another */
+/* and on every dir above them. what it depended on before is forgotten */
+void watch_set(watch_t *w, size_t id, const vec_t *deps)
+{
+	vec_t *mine;
+	size_t nold, off, len, i;
+#ifdef DEBUG
+	assert(NULL != w);
+	assert(NULL != deps);
+#endif
+
+	while (vec_len(&w->deps) <= id) {
+		vec_init(vec_push(&w->deps, NULL), sizeof(watch_key_t *), NULL, 0);
+		vec_push(&w->hit, NULL);
+	}
+	mine = vec_ptr(&w->deps, vec_t, id);
+	w->mark++;
+
+	/* take the new ones before letting go of the old, so the dirs they */
+	/* share stay watched instead of going off and on again */
+	nold = vec_len(mine);
+	for (off = 0; off < vec_len(deps); off += strlen(strtab_at(deps, off)) + 1) {
+		const char *path = strtab_at(deps, off);
+		len = strlen(path);
+		/* the path, then every dir above it up to "/" */
+		while (len > 0) {
+			watch_key_t *k = watch_key(w, path, len);
+			if (k->mark == w->mark)
+				break; /* did it and everything above already */
+			k->mark = w->mark;
+			*(size_t *)vec_push(&k->ids, NULL) = id;
+			*(watch_key_t **)vec_push(mine, NULL) = k;
+			if (1 == len)
+				break;
+			while (len > 1 && '/' != path[len - 1])
+				len--;
+			if (len > 1)
+				len--;
+		}
+	}
+	/* the old ones each still hold a ref of their own for id, the new */
+	/* ones came after them in mine */
+	for (i = 0; i < nold; i++)
+		watch_key_unref(w, vec_at(mine, watch_key_t *, i), id);
+	memmove(vec_ptr(mine, watch_key_t *, 0), vec_ptr(mine, watch_key_t *, nold),
+		(vec_len(mine) - nold) * sizeof(watch_key_t *));
+	vec_truncate(mine, vec_len(mine) - nold);
+}
+
+/* mark the ids that depend on the first len chars of path */
+static void watch_hit(watch_t *w, const char *path, size_t len)
+{
+	watch_node_t **link = watch_tab_find(&w->keys, path, len);
+	watch_key_t *k;
+	size_t i;
+	if (NULL == *link)
+		return;
+	k = (watch_key_t *)*link;
+	for (i = 0; i < vec_len(&k->ids); i++)
+		vec_at(&w->hit, char, vec_at(&k->ids, size_t, i)) = 1;
+}
+
+/* watch the dirs we couldn't before, they may be back */
+static void watch_retry(watch_t *w)
+{
+	watch_node_t *n;
+	size_t i;
+	for (i = 0; i <= w->dirs.mask; i++)
+		for (n = w->dirs.buckets[i]; NULL != n; n = n->next)
+			if (-1 == ((watch_dir_t *)n)->wd)
+				watch_dir_on(w, (watch_dir_t *)n);
+}
+
+/* sleep until a path some answer depends on changes, then put the ids */
+/* that depend on it in ids (size_t), each once */
+void watch_wait(watch_t *w, vec_t *ids)
+{
+	union {
+		struct inotify_event ev; /* for the alignment */
+		char buf[4096];
+	} u;
+	const struct inotify_event *ev;
+	struct pollfd pfd[2];
+	watch_dir_t *d;
+	ssize_t got;
+	size_t i;
+	char *p;
+#ifdef DEBUG
+	assert(NULL != w);
+	assert(NULL != ids);
+#endif
+
+	vec_clear(ids);
+	watch_retry(w);
+	pfd[0].fd = w->ifd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = w->mntfd; /* poll() skips it if it's -1 */
+	pfd[1].events = POLLPRI;
+	while (0 == vec_len(ids)) {
+		if (-1 == poll(pfd, 2, -1)) {
+			if (EINTR == errno)
+				continue;
+			err_bail(__FILE__, __LINE__, "poll on inotify failed");
+		}
+		/* a mount or unmount can land anywhere, no telling which answers */
+		/* it changes. poll() only says so once per change */
+		if (pfd[1].revents & (POLLPRI | POLLERR))
+			memset(vec_ptr(&w->hit, char, 0), 1, vec_len(&w->hit));
+		while (0 < (got = read(w->ifd, u.buf, sizeof u.buf))) {
+			for (p = u.buf; p < u.buf + got; p += sizeof *ev + ev->len) {
+				ev = (const struct inotify_event *)p;
+				if (ev->mask & IN_Q_OVERFLOW) { /* lost some, no telling which */
+					memset(vec_ptr(&w->hit, char, 0), 1, vec_len(&w->hit));
+					continue;
+				}
+				if (NULL == (d = watch_wd(w, ev->wd)))
+					continue; /* one we've let go of */
+				if (0 != ev->len) {
+					/* a name in d, the kernel pads it out with NULs */
+					size_t dlen = strlen(d->path), nlen = strlen(ev->name);
+					char *path = xmalloc(dlen + 1 + nlen + 1);
+					memcpy(path, d->path, dlen);
+					if (dlen > 1) /* no PATHSEP after "/" */
+						path[dlen++] = '/';
+					memcpy(path + dlen, ev->name, nlen + 1);
+					watch_hit(w, path, dlen + nlen);
+					xfree(path);
+					continue;
+				}
+				watch_hit(w, d->path, strlen(d->path));
+				/* the watch went with the dir, if anything's at d's path */
+				/* now it's a different dir */
+				if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_UNMOUNT))
+					watch_dir_off(w, d);
+			}
+		}
+		for (i = 0; i < vec_len(&w->hit); i++)
+			if (vec_at(&w->hit, char, i)) {
+				vec_at(&w->hit, char, i) = 0;
+				*(size_t *)vec_push(ids, NULL) = i;
+			}
+	}
+}
+
+void watch_free(watch_t *w)
+{
+	size_t i;
+	if (NULL == w)
+		return;
+	for (i = 0; i < vec_len(&w->deps); i++) {
+		vec_t *mine = vec_ptr(&w->deps, vec_t, i);
+		while (vec_len(mine) > 0) {
+			watch_key_unref(w, vec_at(mine, watch_key_t *, vec_len(mine) - 1), i);
+			vec_pop(mine);
+		}
+		vec_destroy(mine);
+	}
+	close(w->ifd);
+	if (-1 != w->mntfd)
+		close(w->mntfd);
+	xfree(w->keys.buckets);
+	xfree(w->dirs.buckets);
+	xfree(w->wds);
+	vec_destroy(&w->deps);
+	vec_destroy(&w->hit);
+	xfree(w);
+}
+
+#else /* no inotify */
+
+struct watch {
+	int unused;
+};
+
+watch_t *watch_alloc(void)
+{
+	fatal("--watch needs inotify");
+	return NULL;
+}
+
+void watch_set(watch_t *w, size_t id, const vec_t *deps)
+{
+}
+
+void watch_wait(watch_t *w, vec_t *ids)
+{
+}
+
+void watch_free(watch_t *w)
+{
+}
+
+#endif
+
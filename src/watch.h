@@ -0,0 +1,29 @@
+/* ex: set ts=4: */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "vec.h"
+
+/*
+	shac --watch: answers that stand until a path they were worked out from
+	changes. each answer (by id) comes with the abspaths path_split() went
+	through for it, symlinks and all. an answer depends on every one of
+	those and every dir above them: a chmod, chown, rename, delete or
+	create of any of them, or of the symlink a hop went through, can
+	change it. the dirs they're in are watched with inotify, and
+	watch_wait() sleeps until one of them has news and says which ids
+	need their answers worked out again. nothing is looked at in between.
+*/
+
+#define WATCH_SETTLE	4 /* goes at an answer before a path that won't sit still is left to inotify */
+
+typedef struct watch watch_t;
+
+watch_t *watch_alloc(void);
+void watch_set(watch_t *, size_t, const vec_t *);
+void watch_wait(watch_t *, vec_t *);
+void watch_free(watch_t *);
+
+#endif
+